@@ -0,0 +1,276 @@
+/*
+ * aliaslib.c
+ *
+ * Note:
+ *   The aliases are kept in an open-addressing hash table (linear probing), like the
+ *   variables. The value of an alias is split into words once, when it is defined:
+ *   the alias, its argv array and the words are one allocation, and add_process()
+ *   copies the words into the argv of a process in place of the command name.
+ *   The words are spliced after expansion, so a value may only hold plain words:
+ *   no '|', '<', '>', '&', '$' or '~'.
+ */
+/* $begin aliaslib.c */
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include "aliaslib.h"
+#include "wrapper.h"
+
+
+#define ALIAS_TABLE_MIN	32		/* initial number of slots, a power of 2 */
+#define ALIAS_SPECIAL	"|<>&$~"
+
+static alias deleted_alias;
+#define DELETED			(&deleted_alias)
+
+static alias  **alias_table = NULL;	/* NULL if empty, DELETED if the alias was removed */
+static size_t   table_size = 0;
+static size_t   table_used = 0;		/* slots that are not empty, including deleted ones */
+static size_t   alias_count = 0;
+
+
+/* Return the slot of the alias name (len bytes, not terminated), or -1 if there is none. */
+static
+long
+find_slot (const char * name, size_t len, unsigned long hash)
+{
+	size_t mask = table_size - 1;
+	size_t i;
+
+	if(alias_count == 0)
+		return -1;
+
+	for(i = hash & mask; alias_table[i] != NULL; i = (i + 1) & mask){
+		alias *a = alias_table[i];
+		if(a != DELETED && a -> hash == hash && strncmp(a -> name, name, len) == 0
+		   && (a -> name)[len] == '\0')
+			return i;
+	}
+	return -1;
+}
+
+
+static
+void
+insert_slot (alias * a)
+{
+	size_t mask = table_size - 1;
+	size_t i = a -> hash & mask;
+
+	while(alias_table[i] != NULL && alias_table[i] != DELETED)
+		i = (i + 1) & mask;
+	if(alias_table[i] == NULL)
+		table_used++;
+	alias_table[i] = a;
+}
+
+
+/* Rebuild the table with enough room for one more alias, dropping deleted slots. */
+static
+void
+grow_table (void)
+{
+	alias **old = alias_table;
+	size_t old_size = table_size;
+	size_t new_size = ALIAS_TABLE_MIN;
+	size_t i;
+
+	while(new_size * 3 < (alias_count + 1) * 4 * 2)
+		new_size *= 2;
+
+	alias_table = emalloc(sizeof(alias *) * new_size);
+	memset(alias_table, 0, sizeof(alias *) * new_size);
+	table_size = new_size;
+	table_used = 0;
+
+	for(i = 0; i < old_size; i++)
+		if(old[i] != NULL && old[i] != DELETED)
+			insert_slot(old[i]);
+	free(old);
+}
+
+
+/* Define the alias name as value, replacing an alias of the same name.
+ * Return -1 (with a message) if the name or the value cannot be used.
+ */
+int
+set_alias (const char * name, const char * value)
+{
+	size_t name_len = strlen(name), value_len = strlen(value);
+	size_t argc = 0, bytes = 0;
+	const char *p;
+
+	if(name_len == 0 || name[strcspn(name, " \t=/" ALIAS_SPECIAL)] != '\0'){
+		fprintf(stderr, "alias: %s: invalid alias name\n", name);
+		return -1;
+	}
+	if(value[strcspn(value, ALIAS_SPECIAL)] != '\0'){
+		fprintf(stderr, "alias: %s: the value may only hold plain words\n", name);
+		return -1;
+	}
+
+	/* count the words */
+	for(p = value; *p; ){
+		size_t n;
+		p += strspn(p, " \t");
+		if((n = strcspn(p, " \t")) == 0)
+			break;
+		argc++;
+		bytes += n + 1;
+		p += n;
+	}
+	if(argc == 0){
+		fprintf(stderr, "alias: %s: empty value\n", name);
+		return -1;
+	}
+
+	alias *a = emalloc(sizeof(alias) + sizeof(char *) * (argc + 1) + bytes
+	                   + name_len + 1 + value_len + 1);
+	a -> argv = (char **) (a + 1);
+	a -> argc = argc;
+	a -> bytes = bytes;
+	a -> hash = hash_bytes(name, name_len);
+
+	char *word = (char *) &(a -> argv)[argc + 1];
+	size_t i = 0;
+	for(p = value; i < argc; ){
+		size_t n;
+		p += strspn(p, " \t");
+		n = strcspn(p, " \t");
+		memcpy(word, p, n);
+		word[n] = '\0';
+		(a -> argv)[i++] = word;
+		word += n + 1;
+		p += n;
+	}
+	(a -> argv)[argc] = NULL;
+	a -> name = word;
+	memcpy(a -> name, name, name_len + 1);
+	a -> value = word + name_len + 1;
+	memcpy(a -> value, value, value_len + 1);
+
+	long slot = find_slot(name, name_len, a -> hash);
+	if(slot != -1){
+		free(alias_table[slot]);
+		alias_table[slot] = a;
+		return 0;
+	}
+	if((table_used + 1) * 4 > table_size * 3)
+		grow_table();
+	insert_slot(a);
+	alias_count++;
+	return 0;
+}
+
+
+/* Return -1 if there is no alias name. */
+int
+remove_alias (const char * name)
+{
+	long i = find_slot(name, strlen(name), hash_bytes(name, strlen(name)));
+
+	if(i == -1)
+		return -1;
+	free(alias_table[i]);
+	alias_table[i] = DELETED;
+	alias_count--;
+	return 0;
+}
+
+
+void
+clear_aliases (void)
+{
+	size_t i;
+
+	for(i = 0; i < table_size; i++){
+		if(alias_table[i] != NULL && alias_table[i] != DELETED)
+			free(alias_table[i]);
+		alias_table[i] = NULL;
+	}
+	table_used = 0;
+	alias_count = 0;
+}
+
+
+/* Return the alias name, which is len bytes long and need not be terminated. */
+const alias *
+find_alias (const char * name, size_t len)
+{
+	long i;
+
+	if(alias_count == 0)
+		return NULL;	/* the common case costs no hashing */
+	i = find_slot(name, len, hash_bytes(name, len));
+	return (i == -1) ? NULL : alias_table[i];
+}
+
+
+/* Follow the aliases from the command name (len bytes) while the first word of the
+ * value is an alias too, storing them in chain. An alias is not expanded again
+ * inside its own expansion, and at most MAX_ALIAS_DEPTH are followed.
+ * Return the number of aliases in chain, 0 if name is not an alias.
+ */
+size_t
+resolve_alias (const char * name, size_t len, const alias ** chain)
+{
+	const alias *a = find_alias(name, len);
+	size_t n = 0, k;
+
+	while(a != NULL && n < MAX_ALIAS_DEPTH){
+		for(k = 0; k < n; k++)
+			if(chain[k] == a)
+				return n;
+		chain[n++] = a;
+		a = find_alias((a -> argv)[0], strlen((a -> argv)[0]));
+	}
+	return n;
+}
+
+
+static
+void
+put_alias (const alias * a)
+{
+	printf("alias %s='%s'\n", a -> name, a -> value);
+}
+
+
+/* Return -1 if there is no alias name. */
+int
+print_alias (const char * name)
+{
+	const alias *a = find_alias(name, strlen(name));
+
+	if(a == NULL)
+		return -1;
+	put_alias(a);
+	return 0;
+}
+
+
+static
+int
+compare_alias (const void * a, const void * b)
+{
+	return strcmp((*(const alias **) a) -> name, (*(const alias **) b) -> name);
+}
+
+
+/* Print the aliases in the order of their names. */
+void
+print_alias_list (void)
+{
+	const alias *list[alias_count + 1];
+	size_t i, n = 0;
+
+	for(i = 0; i < table_size; i++)
+		if(alias_table[i] != NULL && alias_table[i] != DELETED)
+			list[n++] = alias_table[i];
+	qsort(list, n, sizeof(alias *), compare_alias);
+	for(i = 0; i < n; i++)
+		put_alias(list[i]);
+}
+
+
+/* $end aliaslib.c */
@@ -0,0 +1,34 @@
+/* 
+ * aliaslib.h
+ */
+/* $begin aliaslib.h */
+#ifndef __ALIASLIB_H__
+#define __ALIASLIB_H__
+
+
+#include <stddef.h>
+
+#define MAX_ALIAS_DEPTH	16		/* bound on aliases that expand to aliases */
+
+typedef struct alias
+{
+	char *name;
+	char *value;				/* the text of the definition */
+	char **argv;				/* its words, split once when it is defined */
+	size_t argc;
+	size_t bytes;				/* length of the words, each with its '\0' */
+	unsigned long hash;			/* cached hash of name */
+} alias;
+
+
+extern int set_alias (const char * name, const char * value);
+extern int remove_alias (const char * name);
+extern void clear_aliases (void);
+extern const alias * find_alias (const char * name, size_t len);
+extern size_t resolve_alias (const char * name, size_t len, const alias ** chain);
+extern int print_alias (const char * name);
+extern void print_alias_list (void);
+
+
+#endif /* __ALIASLIB_H__ */
+/* $end aliaslib.h */
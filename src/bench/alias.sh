@@ -0,0 +1,38 @@
+#!/bin/bash
+#
+# alias.sh
+#
+# Note:
+#   Runs <n> lines of true alpha beta gamma delta with no alias defined, then the
+#   same lines with an alias defined, then <n> lines of tt delta through the alias
+#   tt='true alpha beta gamma'.
+#   Usage: alias.sh <myshell> [<n>]
+#
+shell=$1
+n=${2:-60000}
+if [ ! -x "$shell" ]; then
+	echo "usage: alias.sh <myshell> [<n>]" >&2
+	exit 2
+fi
+
+dir=$(mktemp -d)
+trap 'rm -rf "$dir"' EXIT
+
+for ((i = 0; i < n; i++)); do
+	echo "true alpha beta gamma delta"
+done > "$dir/typed.sh"
+for ((i = 0; i < n; i++)); do
+	echo "tt delta"
+done > "$dir/tt.sh"
+{ echo "alias tt='true alpha beta gamma'"; cat "$dir/typed.sh"; } > "$dir/defined.sh"
+{ echo "alias tt='true alpha beta gamma'"; cat "$dir/tt.sh"; } > "$dir/alias.sh"
+
+TIMEFORMAT="%R s wall, %U s user, %S s sys"
+while read -r name script; do
+	printf "%-24s " "$name:"
+	{ time "$shell" < "$dir/$script" > /dev/null; } 2>&1
+done <<EOF2
+no-alias-defined         typed.sh
+alias-defined            defined.sh
+through-the-alias        alias.sh
+EOF2
@@ -0,0 +1,55 @@
+#!/bin/bash
+#
+# builtins.sh
+#
+# Note:
+#   Compares the builtin test, echo and printf with the programs of the same name.
+#   A script of <n> x (test, echo, printf) lines is generated twice, once with the
+#   builtin names and once with the full paths of the programs, and each is run by
+#   the shell (fork and spawn launch modes for the programs). The outputs must match.
+#   Then <n> lines of "echo line N >> file" and of "true | echo line N" are run.
+#   Usage: builtins.sh <myshell> [<n>]
+#
+shell=$1
+n=${2:-2000}
+if [ ! -x "$shell" ]; then
+	echo "usage: builtins.sh <myshell> [<n>]" >&2
+	exit 2
+fi
+
+dir=$(mktemp -d)
+trap 'rm -rf "$dir"' EXIT
+test_bin=$(type -P test) echo_bin=$(type -P echo) printf_bin=$(type -P printf)
+
+for ((i = 0; i < n; i++)); do
+	echo "test $i -lt $n"
+	echo "echo line $i"
+	echo "printf %s-%d\\n x $i"
+done > "$dir/builtin.sh"
+sed -e "s|^test |$test_bin |" -e "s|^echo |$echo_bin |" -e "s|^printf |$printf_bin |" \
+	"$dir/builtin.sh" > "$dir/extern.sh"
+{ echo "set LAUNCHMODE spawn"; cat "$dir/extern.sh"; } > "$dir/spawn.sh"
+
+for ((i = 0; i < n; i++)); do
+	echo "echo line $i >> $dir/append.txt"
+done > "$dir/append.sh"
+for ((i = 0; i < n; i++)); do
+	echo "true | echo line $i"
+done > "$dir/pipe.sh"
+
+TIMEFORMAT="%R s wall, %U s user, %S s sys"
+for s in builtin extern spawn; do
+	printf "%-8s %d lines: " $s $((3 * n))
+	{ time "$shell" "$dir/$s.sh" > "$dir/$s.out"; } 2>&1
+done
+for s in append pipe; do
+	printf "%-8s %d lines: " $s $n
+	{ time "$shell" "$dir/$s.sh" > "$dir/$s.out"; } 2>&1
+done
+
+if cmp -s "$dir/builtin.out" "$dir/extern.out" && cmp -s "$dir/builtin.out" "$dir/spawn.out"; then
+	echo "outputs match"
+else
+	echo "outputs differ" >&2
+	exit 1
+fi
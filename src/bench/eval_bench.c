@@ -0,0 +1,83 @@
+/*
+ * eval_bench.c
+ *
+ * Note:
+ *   Measures how many command lines per second eval_cmd() turns into jobs. A line of
+ *   <words> words is generated with a variable every 5 words and a pipe every 16, and is
+ *   evaluated <iters> times; the job is freed without being launched. The command
+ *   cache is cleared before each evaluation unless -c is given, so that the lexer and
+ *   the compiler are measured, not only the expansion of a cached template.
+ *   Usage: eval_bench [-c] <words> <iters>
+ */
+/* $begin eval_bench.c */
+#define _POSIX_C_SOURCE 200809L	/* for clock_gettime(), see FEATURE_TEST_MACROS(7) */
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+#include "myshell.h"
+#include "variablelib.h"
+#include "wrapper.h"
+
+
+static
+double
+now (void)
+{
+	struct timespec ts;
+
+	clock_gettime(CLOCK_MONOTONIC, &ts);
+	return ts.tv_sec + ts.tv_nsec / 1e9;
+}
+
+
+int
+main (int argc, char * argv[])
+{
+	int cached = (argc > 1 && strcmp(argv[1], "-c") == 0);
+	int words, iters, i;
+	size_t n = 0;
+	double t;
+
+	if(argc != 3 + cached){
+		fprintf(stderr, "usage: eval_bench [-c] <words> <iters>\n");
+		exit(2);
+	}
+	words = atoi(argv[1 + cached]);
+	iters = atoi(argv[2 + cached]);
+
+	set_variable("V", "value");
+	record_history = 0;		/* as for a script */
+
+	char *line = emalloc((size_t) words * 32 + 64);
+	n += sprintf(line + n, "cmd");
+	for(i = 0; i < words; i++){
+		if(i % 16 == 15)
+			n += sprintf(line + n, "   |  stage%d", i);
+		else if(i % 5 == 0)
+			n += sprintf(line + n, "   arg$V%d", i);
+		else
+			n += sprintf(line + n, "  argument_%d", i);
+	}
+	sprintf(line + n, " > /dev/null");
+
+	t = now();
+	for(i = 0; i < iters; i++){
+		if(!cached)
+			clear_cmdcache();
+		if(eval_cmd(line) == -1){
+			fprintf(stderr, "eval_bench: eval_cmd failed\n");
+			exit(1);
+		}
+		remove_job(current_job);
+	}
+	t = now() - t;
+
+	printf("%5d words%s: %10.0f cmds/sec\n", words, cached ? ", cached" : "", iters / t);
+	free(line);
+	return 0;
+}
+
+
+/* $end eval_bench.c */
@@ -0,0 +1,248 @@
+/*
+ * hist_bench.c
+ *
+ * Note:
+ *   Measures the startup cost of a large history file: init_hist(), the first use of
+ *   the history (which loads the last HISTSIZE records, <size> if given) and a later use.
+ *   -g <n> writes a new file of <n> entries with add_hist(), so that it has the format
+ *   of historylib.c. -c drops the file from the page cache first (posix_fadvise()),
+ *   for a cold start. -p prints the history list <reps> times to the standard output,
+ *   as the history builtin does, and reports the time of a listing on the standard error.
+ *   -s <n> fills a list of HISTSIZE <n> without a file, then times search_hist() on a 
+ *   few queries against a backward scan of get_hist().
+ *   -d <n> fills a list of HISTSIZE <n> with <n> distinct entries, then times 10 * <n> 
+ *   adds that cycle over 50 commands, and get_hist(), for each HISTCONTROL mode.
+ *   -a appends 10000 entries to <file> with HISTSHARE set, reading each one back.
+ *   Usage: hist_bench -g <n> <file>
+ *          hist_bench [-c] <file> [<size>]
+ *          hist_bench -p <reps> <file>
+ *          hist_bench -s <n>
+ *          hist_bench -d <n>
+ *          hist_bench -a <file>
+ */
+/* $begin hist_bench.c */
+#define _POSIX_C_SOURCE 200809L	/* for clock_gettime() and posix_fadvise() */
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+#include <fcntl.h>
+#include <unistd.h>
+#include <sys/resource.h>
+#include "historylib.h"
+
+
+static
+double
+now (void)
+{
+	struct timespec ts;
+
+	clock_gettime(CLOCK_MONOTONIC, &ts);
+	return ts.tv_sec + ts.tv_nsec / 1e9;
+}
+
+
+/* Return the number of the newest entry that starts with or contains s, as 
+ * search_hist() without its index.
+ */
+static
+int
+scan_hist (const char * s, int prefix)
+{
+	size_t len = strlen(s);
+	int i;
+
+	for(i = count_hist(); i > 0; i--){
+		char *h = get_hist(i);
+		if(prefix ? strncmp(h, s, len) == 0 : strstr(h, s) != NULL)
+			return i;
+	}
+	return 0;
+}
+
+
+static
+void
+time_search (const char * what, const char * s, int prefix)
+{
+	double t0, t1, t2;
+	int i, found = 0, scanned = 0;
+
+	t0 = now();
+	for(i = 0; i < 1000; i++)
+		found = search_hist(s, strlen(s), prefix, 0);
+	t1 = now();
+	for(i = 0; i < 10; i++)
+		scanned = scan_hist(s, prefix);
+	t2 = now();
+	printf("%-22s %10.2f us   (scan %10.2f us)%s\n", what, (t1 - t0) * 1e6 / 1000, 
+	       (t2 - t1) * 1e6 / 10, (found == scanned) ? "" : "  MISMATCH");
+}
+
+
+static
+void
+usage (void)
+{
+	fprintf(stderr, "usage: hist_bench -g <n> <file>\n"
+	                "       hist_bench [-c] <file> [<size>]\n"
+	                "       hist_bench -p <reps> <file>\n"
+	                "       hist_bench -s <n>\n"
+	                "       hist_bench -d <n>\n"
+	                "       hist_bench -a <file>\n");
+	exit(2);
+}
+
+
+int
+main (int argc, char * argv[])
+{
+	double t0, t1, t2, t3;
+	char *path, *h;
+	int fd;
+
+	if(argc == 4 && strcmp(argv[1], "-g") == 0){
+		long n = atol(argv[2]), i;
+		char line[64];
+
+		path = argv[3];
+		unlink(path);
+		set_hist_size("1");		/* only the file matters */
+		if(n <= 0 || init_hist(path) == -1)
+			usage();
+		for(i = 0; i < n; i++){
+			sprintf(line, "cmd number %ld --flag", i);
+			add_hist(line);
+		}
+		printf("%s: %ld entries\n", path, n);
+		return 0;
+	}
+
+	if(argc == 4 && strcmp(argv[1], "-p") == 0){
+		int reps = atoi(argv[2]), i;
+
+		if(reps <= 0 || init_hist(argv[3]) == -1)
+			usage();
+		get_hist(1);		/* load the file first */
+		t0 = now();
+		for(i = 0; i < reps; i++)
+			print_hist_list();
+		fflush(stdout);
+		t1 = now();
+		fprintf(stderr, "history: %.1f us per listing\n", (t1 - t0) * 1e6 / reps);
+		return 0;
+	}
+
+	if(argc == 3 && strcmp(argv[1], "-s") == 0){
+		long n = atol(argv[2]), i;
+		char line[64];
+		struct rusage ru;
+
+		if(n <= 0)
+			usage();
+		sprintf(line, "%ld", n);
+		set_hist_size(line);
+		t0 = now();
+		for(i = 0; i < n; i++){
+			sprintf(line, "cmd number %ld --flag", i);
+			add_hist(line);
+		}
+		t1 = now();
+		printf("%-22s %10.2f us per entry\n", "add_hist", (t1 - t0) * 1e6 / n);
+
+		sprintf(line, "cmd number %ld", n - 1);
+		time_search("prefix, newest", line, 1);
+		time_search("prefix, oldest", "cmd number 0 ", 1);
+		time_search("prefix, no match", "cmd number x", 1);
+		sprintf(line, "number %ld ", n / 2);
+		time_search("substring, middle", line, 0);
+		time_search("substring, no match", "--flags", 0);
+		getrusage(RUSAGE_SELF, &ru);
+		printf("peak RSS %ld MB\n", ru.ru_maxrss / 1024);
+		return 0;
+	}
+
+	if(argc == 3 && strcmp(argv[1], "-d") == 0){
+		static const char *modes[] = { "", "ignoredups", "erasedups" };
+		long n = atol(argv[2]), i;
+		char line[64], size[24];
+		int m;
+
+		if(n <= 0)
+			usage();
+		sprintf(size, "%ld", n);
+		for(m = 0; m < 3; m++){
+			set_hist_size("0");		/* empty the list */
+			set_hist_size(size);
+			set_hist_control(modes[m]);
+			for(i = 0; i < n; i++){
+				sprintf(line, "cmd number %ld --flag", i);
+				add_hist(line);
+			}
+			t0 = now();
+			for(i = 0; i < 10 * n; i++){
+				sprintf(line, "cmd number %ld --flag", i % 50);
+				add_hist(line);
+			}
+			t1 = now();
+			int count = count_hist();
+			for(i = 0; i < 1000000; i++)
+				h = get_hist(1 + i % count);
+			t2 = now();
+			printf("HISTCONTROL=%-10s %6.2f us per add, get_hist %.3f us (%d entries)\n", 
+			       modes[m], (t1 - t0) * 1e6 / (10 * n), (t2 - t1) * 1e6 / 1000000, count);
+		}
+		return 0;
+	}
+
+	if(argc == 3 && strcmp(argv[1], "-a") == 0){
+		char line[64];
+		int i;
+
+		if(init_hist(argv[2]) == -1)
+			usage();
+		set_hist_share("1");
+		get_hist(1);		/* load the file first */
+		t0 = now();
+		for(i = 0; i < 10000; i++){
+			sprintf(line, "shared cmd %d", i);
+			add_hist(line);
+			count_hist();	/* reads it back */
+		}
+		t1 = now();
+		printf("HISTSHARE: %.2f us per add and sync (last \"%s\")\n", 
+		       (t1 - t0) * 1e6 / 10000, get_hist(count_hist()));
+		return 0;
+	}
+
+	int cold = (argc >= 3 && strcmp(argv[1], "-c") == 0);
+	if(argc != 2 + cold && argc != 3 + cold)
+		usage();
+	path = argv[1 + cold];
+	if(argc == 3 + cold)
+		set_hist_size(argv[2 + cold]);
+	if(cold && (fd = open(path, O_RDONLY)) != -1){
+		fdatasync(fd);
+		posix_fadvise(fd, 0, 0, POSIX_FADV_DONTNEED);
+		close(fd);
+	}
+
+	t0 = now();
+	if(init_hist(path) == -1)
+		exit(1);
+	t1 = now();
+	h = get_hist(1);
+	t2 = now();
+	h = get_hist(1);
+	t3 = now();
+
+	printf("%s: init_hist %.3f ms, first use %.3f ms, later use %.6f ms (%d entries, first \"%s\")\n", 
+	       cold ? "cold" : "warm", (t1 - t0) * 1e3, (t2 - t1) * 1e3, (t3 - t2) * 1e3, 
+	       count_hist(), (h != (char *) -1) ? h : "");
+	return 0;
+}
+
+
+/* $end hist_bench.c */
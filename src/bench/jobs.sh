@@ -0,0 +1,30 @@
+#!/bin/bash
+#
+# jobs.sh
+#
+# Note:
+#   Stress test of the job bookkeeping: a script of <n> "sleep &" lines followed by
+#   jobs is run by the shell. The shell exits without waiting for the sleeps, so the
+#   user and system times that bash's time reports are those of the shell alone; most
+#   of the system time is fork() itself. The sleeps are killed afterwards.
+#   Usage: jobs.sh <myshell> [<n>]
+#
+shell=$1
+n=${2:-10000}
+if [ ! -x "$shell" ]; then
+	echo "usage: jobs.sh <myshell> [<n>]" >&2
+	exit 2
+fi
+
+dir=$(mktemp -d)
+nap=20.$$		# unique, so that only these sleeps are killed
+trap 'pkill -x -f "sleep $nap"; rm -rf "$dir"' EXIT
+
+for ((i = 0; i < n; i++)); do
+	echo "sleep $nap &"
+done > "$dir/jobs.sh"
+echo "jobs 2> /dev/null" >> "$dir/jobs.sh"	# jobs reports on stderr
+
+TIMEFORMAT="%R s wall, %U s user, %S s sys"
+printf "%d background jobs: " $n
+{ time env -u MAXJOBS "$shell" "$dir/jobs.sh"; } 2>&1
@@ -0,0 +1,57 @@
+#!/bin/bash
+#
+# loop.sh
+#
+# Note:
+#   Runs a loop of <n> iterations of two builtins,
+#       while test $i -lt <n>
+#       do let i=i+1
+#       done
+#   as a compound command, and the same 2 x <n> commands unrolled one per line, which
+#   the shell reads and looks up in the command cache line by line. dash and bash run
+#   the loop too, if they are installed. Every run must print <n>.
+#   Usage: loop.sh <myshell> [<n>]
+#
+shell=$1
+n=${2:-1000000}
+if [ ! -x "$shell" ]; then
+	echo "usage: loop.sh <myshell> [<n>]" >&2
+	exit 2
+fi
+
+dir=$(mktemp -d)
+trap 'rm -rf "$dir"' EXIT
+
+printf 'set i 0\nwhile test $i -lt %d\ndo let i=i+1\ndone\necho $i\n' $n > "$dir/loop.sh"
+{
+	echo "set i 0"
+	for ((i = 0; i < n; i++)); do
+		echo "test \$i -lt $n"
+		echo "let i=i+1"
+	done
+	echo "echo \$i"
+} > "$dir/unrolled.sh"
+printf 'i=0\nwhile [ $i -lt %d ]; do i=$((i+1)); done\necho $i\n' $n > "$dir/loop.sh.posix"
+
+run ()
+{
+	local label=$1
+	shift
+	printf "%-10s " "$label"
+	{ time "$@" > "$dir/out"; } 2>&1 | tr -d '\n'
+	if [ "$(cat "$dir/out")" = "$n" ]; then
+		echo
+	else
+		echo " (printed $(cat "$dir/out"))"
+		status=1
+	fi
+}
+
+TIMEFORMAT="%R s wall, %U s user, %S s sys"
+status=0
+run loop "$shell" "$dir/loop.sh"
+run unrolled "$shell" "$dir/unrolled.sh"
+for sh in dash bash; do
+	type -P $sh > /dev/null && run $sh $sh "$dir/loop.sh.posix"
+done
+exit $status
@@ -0,0 +1,24 @@
+#!/bin/bash
+#
+# parallel.sh
+#
+# Note:
+#   Runs <n> items, 8 at a time, through the parallel builtin with /bin/true and with
+#   the true builtin, and through xargs -P 8 for comparison. The items are read from
+#   the standard input, as seq writes them.
+#   Usage: parallel.sh <myshell> [<n>]
+#
+shell=$1
+n=${2:-2000}
+if [ ! -x "$shell" ]; then
+	echo "usage: parallel.sh <myshell> [<n>]" >&2
+	exit 2
+fi
+
+TIMEFORMAT="%R s wall, %U s user, %S s sys"
+printf "%-34s " "parallel -j 8 /bin/true:"
+{ time seq "$n" | "$shell" -c "parallel -j 8 /bin/true"; } 2>&1
+printf "%-34s " "xargs -P 8 -n 1 /bin/true:"
+{ time seq "$n" | xargs -P 8 -n 1 /bin/true; } 2>&1
+printf "%-34s " "parallel -j 8 true (builtin):"
+{ time seq "$n" | "$shell" -c "parallel -j 8 true"; } 2>&1
@@ -0,0 +1,27 @@
+#!/bin/bash
+#
+# pipes.sh
+#
+# Note:
+#   Runs head -c <bytes> /dev/zero | cat | cat | wc -c in the shell with the default
+#   pipes, with PIPESIZE=1M, with PIPESTATS=on, and with both.
+#   Usage: pipes.sh <myshell> [<bytes>]
+#
+shell=$1
+bytes=${2:-4000000000}
+if [ ! -x "$shell" ]; then
+	echo "usage: pipes.sh <myshell> [<bytes>]" >&2
+	exit 2
+fi
+
+TIMEFORMAT="%R s wall, %U s user, %S s sys"
+while read -r name settings; do
+	printf "%-26s " "$name:"
+	{ time printf "%b\nhead -c %d /dev/zero | cat | cat | wc -c\n" "$settings" "$bytes" \
+		| "$shell" > /dev/null; } 2>&1
+done <<EOF
+default
+PIPESIZE=1M              set PIPESIZE 1M
+PIPESTATS=on             set PIPESTATS on
+PIPESTATS=on,PIPESIZE=1M set PIPESTATS on\nset PIPESIZE 1M
+EOF
@@ -0,0 +1,39 @@
+#!/bin/bash
+#
+# rc.sh
+#
+# Note:
+#   Times <n> starts of myshell -c true without an rc file, with a generated rc file
+#   of 400 set and 100 export lines, and with the same rc file replayed from its
+#   snapshot. The first start with the snapshot writes it and is not counted.
+#   Usage: rc.sh <myshell> [<n>]
+#
+shell=$1
+n=${2:-200}
+if [ ! -x "$shell" ]; then
+	echo "usage: rc.sh <myshell> [<n>]" >&2
+	exit 2
+fi
+
+dir=$(mktemp -d)
+trap 'rm -rf "$dir"' EXIT
+
+for ((i = 0; i < 400; i++)); do
+	echo "set RC_VAR$i value$i"
+done > "$dir/rc"
+for ((i = 0; i < 100; i++)); do
+	echo "export RC_VAR$i"
+done >> "$dir/rc"
+MYSHELLRC="$dir/rc" MYSHELLRC_SNAPSHOT="$dir/snap" "$shell" -c true
+
+TIMEFORMAT="%R"
+while read -r name rc snap; do
+	t=$({ time for ((i = 0; i < n; i++)); do
+		MYSHELLRC=$rc MYSHELLRC_SNAPSHOT=$snap "$shell" -c true
+	done; } 2>&1)
+	awk -v name="$name" -v t="$t" -v n="$n" 'BEGIN { printf "%-16s %6.2f ms per start\n", name ":", t * 1e3 / n }'
+done <<EOF2
+no-rc-file
+rc-file-parsed $dir/rc
+from-snapshot  $dir/rc $dir/snap
+EOF2
@@ -0,0 +1,40 @@
+#!/bin/bash
+#
+# spawn.sh
+#
+# Note:
+#   Compares the fork and spawn launch modes as the shell grows: a script first sets
+#   <mb> variables of 1 MB each, then runs <n> true commands. The time of the same
+#   script without the true lines is subtracted, which leaves the launches.
+#   Usage: spawn.sh <myshell> [<n>] [<mb>...]
+#
+shell=$1
+n=${2:-1000}
+if [ ! -x "$shell" ]; then
+	echo "usage: spawn.sh <myshell> [<n>] [<mb>...]" >&2
+	exit 2
+fi
+shift $(($# < 2 ? $# : 2))
+sizes=${*:-0 200}
+
+dir=$(mktemp -d)
+trap 'rm -rf "$dir"' EXIT
+value=$(head -c 1048576 /dev/zero | tr '\0' x)
+
+TIMEFORMAT="%R"
+for mb in $sizes; do
+	for ((i = 0; i < mb; i++)); do
+		echo "set V$i $value"
+	done > "$dir/heap.sh"
+	for ((i = 0; i < n; i++)); do
+		echo "true"
+	done > "$dir/true.sh"
+	for mode in fork spawn; do
+		{ echo "set LAUNCHMODE $mode"; cat "$dir/heap.sh"; } > "$dir/base.sh"
+		cat "$dir/base.sh" "$dir/true.sh" > "$dir/run.sh"
+		base=$({ time "$shell" < "$dir/base.sh" > /dev/null; } 2>&1)
+		run=$({ time "$shell" < "$dir/run.sh" > /dev/null; } 2>&1)
+		awk -v mb="$mb" -v mode="$mode" -v n="$n" -v base="$base" -v run="$run" \
+			'BEGIN { printf "%4d MB of variables, %-5s %8.0f us per launch\n", mb, mode, (run - base) * 1e6 / n }'
+	done
+done
@@ -0,0 +1,31 @@
+#!/bin/bash
+#
+# trace.sh
+#
+# Note:
+#   Runs a script of <n> x (test, echo, printf) builtin lines with tracing off, as the
+#   shell starts, and again after trace on, to show what the trace points cost.
+#   Usage: trace.sh <myshell> [<n>]
+#
+shell=$1
+n=${2:-20000}
+if [ ! -x "$shell" ]; then
+	echo "usage: trace.sh <myshell> [<n>]" >&2
+	exit 2
+fi
+
+dir=$(mktemp -d)
+trap 'rm -rf "$dir"' EXIT
+
+for ((i = 0; i < n; i++)); do
+	echo "test $i -lt $n"
+	echo "echo line $i"
+	echo "printf %s-%d\\n x $i"
+done > "$dir/off.sh"
+{ echo "trace on"; cat "$dir/off.sh"; } > "$dir/on.sh"
+
+TIMEFORMAT="%R s wall, %U s user, %S s sys"
+for mode in off on; do
+	printf "trace %-3s %d lines: " "$mode" $((n * 3))
+	{ time "$shell" < "$dir/$mode.sh" > /dev/null; } 2>&1
+done
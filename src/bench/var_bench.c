@@ -0,0 +1,71 @@
+/*
+ * var_bench.c
+ *
+ * Note:
+ *   Measures the variable table with <n> variables (default 10000): creating them,
+ *   1M lookups spread over all of them, and deleting every other one. The names are
+ *   formatted with sprintf() inside the timed loops, as a shell would build them.
+ *   Usage: var_bench [<n>]
+ */
+/* $begin var_bench.c */
+#define _POSIX_C_SOURCE 200809L	/* for clock_gettime(), see FEATURE_TEST_MACROS(7) */
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <time.h>
+#include "variablelib.h"
+
+#define LOOKUPS		1000000
+
+
+static
+double
+now (void)
+{
+	struct timespec ts;
+
+	clock_gettime(CLOCK_MONOTONIC, &ts);
+	return ts.tv_sec + ts.tv_nsec / 1e9;
+}
+
+
+int
+main (int argc, char * argv[])
+{
+	int n = (argc > 1) ? atoi(argv[1]) : 10000;
+	long found = 0;
+	double t0, t1, t2, t3;
+	char name[32];
+	int i;
+
+	if(n <= 0){
+		fprintf(stderr, "usage: var_bench [<n>]\n");
+		exit(2);
+	}
+
+	t0 = now();
+	for(i = 0; i < n; i++){
+		sprintf(name, "VAR_%d", i);
+		set_variable(name, "value");
+	}
+	t1 = now();
+	for(i = 0; i < LOOKUPS; i++){
+		sprintf(name, "VAR_%d", (int) ((i * 7919L) % n));
+		found += (get_value_by_name(name) != NULL);
+	}
+	t2 = now();
+	for(i = 0; i < n; i += 2){
+		sprintf(name, "VAR_%d", i);
+		delete_variable(name);
+	}
+	t3 = now();
+
+	printf("insert %d: %.3f ms\n", n, (t1 - t0) * 1e3);
+	printf("%d lookups: %.1f ms (%.0f ns each, %ld found)\n", 
+	       LOOKUPS, (t2 - t1) * 1e3, (t2 - t1) * 1e9 / LOOKUPS, found);
+	printf("delete %d: %.3f ms\n", (n + 1) / 2, (t3 - t2) * 1e3);
+	return 0;
+}
+
+
+/* $end var_bench.c */
@@ -5,19 +5,33 @@
  *   If you want to add a built-in command, you need to provide its handler function, 
  *   which has the following function prototype:
  *     int bc_do_<name> (int argc, char ** argv)
- *   The handler should return -1 on error and 1 on success.
+ *   The handler should return -1 on error and 1 on success. A handler that reports a false 
+ *   condition without an error (test, false) returns 0, and test returns -2 for a bad 
+ *   expression. exec_builtin() turns these into the exit status 1, 0, 1 and 2.
  *   You also need to append _(<name>) to the macro FORALL_BC(_), and you also need to modify 
  *   the macro HELP_MESSAGE to make the built-in help work correctly.
  */
 /* $begin builtin_cmd.c */
+#define _POSIX_C_SOURCE 200809L	/* for the termios functions, see FEATURE_TEST_MACROS(7) */
+
 #include <stdio.h>
 #include <stdlib.h>
 #include <string.h>
 #include <unistd.h>
 #include <errno.h>
+#include <fcntl.h>
+#include <termios.h>
+#include <signal.h>
+#include <inttypes.h>
+#include <limits.h>
+#include <sys/stat.h>
 #include "myshell.h"
 #include "historylib.h"
 #include "variablelib.h"
+#include "aliaslib.h"
+#include "pathlib.h"
+#include "tracelib.h"
+#include "snapshotlib.h"
 #include "wrapper.h"
 
 typedef int (*bchandler_t)(int, char **);
@@ -31,32 +45,99 @@ typedef struct bc_entry
 #define FORALL_BC(_) _(exit) \
 					 _(help) \
 					 _(history) \
+					 _(rsearch) \
 					 _(set) \
 					 _(unset) \
+					 _(export) \
 					 _(pwd) \
 					 _(cd) \
+					 _(hash) \
 					 _(jobs) \
 					 _(fg) \
-					 _(bg)
+					 _(bg) \
+					 _(meminfo) \
+					 _(cmdcache) \
+					 _(echo) \
+					 _(printf) \
+					 _(test) \
+					 _(true) \
+					 _(false) \
+					 _(parallel) \
+					 _(time) \
+					 _(trace) \
+					 _(alias) \
+					 _(unalias) \
+					 _(let)
 
 #define ADD_BC_ENTRY(NAME) {#NAME, bc_do_##NAME},
 
 #define HELP_MESSAGE "Builtin command: \n" \
-	                 "  exit - Exit the shell.\n" \
+	                 "  exit [<n>] - Exit the shell with the status <n>, or the status of the last command.\n" \
 	                 "  help - Display information about builtin commands.\n" \
 	                 "  history - Display the history list.\n" \
+	                 "  rsearch [<string>] - Search the history list backwards as you type, and run the \n" \
+	                 "                       entry shown when Enter is pressed. Ctrl-R finds the next older \n" \
+	                 "                       match, Ctrl-G or Esc cancels.\n" \
 	                 "  set [<name>] [<value>] - 1. set : Check the names and values of all shell variables.\n" \
 	                 "                           2. set <name> : Check the value of the variable named <name>.\n" \
 	                 "                           3. set <name> <value> : Create a new variable with the name <name> and the \n" \
 	                 "                              value <value>, or update the value of the variable named <name> to <value>.\n" \
-	                 "  unset <name> - Delete the shell variable named <name>.\n" \
+	                 "                           4. set -b, set +b : Report finished and stopped jobs as soon as \n" \
+	                 "                              they change, or only before the next prompt (default).\n" \
+	                 "  unset [-x] <name> - Delete the shell variable named <name>, or only remove it from \n" \
+	                 "                      the environment (-x).\n" \
+	                 "  export [<name>[=<value>]] - 1. export : List the exported variables.\n" \
+	                 "                              2. export <name> : Put the variable <name> into the environment.\n" \
+	                 "                              3. export <name>=<value> : Set the variable <name> to <value> and \n" \
+	                 "                                 put it into the environment.\n" \
 	                 "  pwd - Print the absolute pathname of the current working directory.\n" \
 	                 "  cd <dir> - Change the current working directory to <dir>.\n" \
-	                 "  jobs - Display status of jobs.\n" \
+	                 "  hash [-r] [<name>...] - 1. hash : Display the remembered full pathnames of commands.\n" \
+	                 "                          2. hash -r : Forget all the remembered pathnames.\n" \
+	                 "                          3. hash <name>... : Look up each <name> in PATH and remember it.\n" \
+	                 "  jobs [-v] - Display status of jobs, and the traffic of their pipes if PIPESTATS is on. \n" \
+	                 "              With MAXJOBS set, also the number of running and queued background jobs. \n" \
+	                 "              -v also lists the last finished background jobs, and the times of the \n" \
+	                 "              processes of every job as time reports them.\n" \
 	                 "  fg <job_id> - Move job to the foreground.\n" \
 	                 "  bg <job_id> - Move job to the background.\n" \
+	                 "  meminfo - Display usage and fragmentation of the job arenas.\n" \
+	                 "  cmdcache [-c] - Display hit-rate statistics of the parsed-command cache, \n" \
+	                 "                  or clear the cache (-c).\n" \
+	                 "  echo [-neE] [<arg>...] - Write the arguments separated by blanks, without the final newline (-n), \n" \
+	                 "                           expanding backslash escapes (-e) or not (-E, default).\n" \
+	                 "  printf <format> [<arg>...] - Write the arguments under the control of <format>, reusing it \n" \
+	                 "                               until the arguments are used up.\n" \
+	                 "  test <expr>, [ <expr> ] - Evaluate the conditional expression <expr>.\n" \
+	                 "  true, false - Return a successful or unsuccessful status.\n" \
+	                 "  parallel [-j <n>] [-v] <command> [<arg>...] [::: <item>...] - Run <command> once for \n" \
+	                 "                           every <item> (or line of the standard input), with {} in the \n" \
+	                 "                           arguments replaced by it or the item appended, keeping <n> \n" \
+	                 "                           (default: the number of CPUs) running at a time. Failed items \n" \
+	                 "                           are reported with their exit status, or all of them (-v).\n" \
+	                 "  time [<pipeline>] - Run <pipeline> and report the wall clock time, user and system CPU \n" \
+	                 "                      time and peak resident set size of each stage and of the whole \n" \
+	                 "                      job. Without <pipeline>, report the times of the shell and of \n" \
+	                 "                      its finished children.\n" \
+	                 "  trace [on [<n>] | off | clear | dump] - 1. trace : Display whether tracing is on and the number of events.\n" \
+	                 "                           2. trace on [<n>] : Record the time of each phase of the commands (expansion, \n" \
+	                 "                              path lookup, fork, wait, terminal handoff), keeping the last <n> \n" \
+	                 "                              events (default: 4096, at most 1048576).\n" \
+	                 "                           3. trace off, trace clear : Stop recording, or drop the recorded events.\n" \
+	                 "                           4. trace dump : Write the events as a Chrome trace (JSON) that \n" \
+	                 "                              chrome://tracing and Perfetto can load, e.g. trace dump > shell.json\n" \
+	                 "  alias [<name>[=<value>]...] - 1. alias : List the aliases.\n" \
+	                 "                               2. alias <name> : Display the alias <name>.\n" \
+	                 "                               3. alias <name>=<value> : Make <name> stand for the words of \n" \
+	                 "                                  <value> as a command name, e.g. alias ll='ls -l --color'. \n" \
+	                 "                                  <value> may only hold plain words.\n" \
+	                 "  unalias [-a] [<name>...] - Remove the aliases <name>, or all of them (-a).\n" \
+	                 "  let [<name>=]<expr>... - Evaluate each integer expression <expr> (+ - * / %%, parentheses, \n" \
+	                 "                           numbers and variable names), assigning the value to <name> if \n" \
+	                 "                           given, e.g. let i=i+1. Fails if the last value is 0.\n" \
 	                 "\n" \
-	                 "Note: Builtin commands does not support pipelines and I/O redirection.\n"
+	                 "Note: Builtin commands support I/O redirection and run in the shell. In a pipeline, only \n" \
+	                 "      the last stage of a foreground job runs in the shell; other stages run in a child.\n"
 
 
 /********************************
@@ -68,14 +149,27 @@ static
 int
 bc_do_exit (int argc, char ** argv)
 {
-	if(argc > 1){
+	int status = last_status;
+
+	if(argc > 2){
 		fprintf(stderr, "exit: too many arguments\n");
 		return -1;
 	}
 
-	printf("logout\n");
+	if(argc == 2){
+		char *end;
+		long n = strtol(argv[1], &end, 10);
+		if(end == argv[1] || *end != '\0'){
+			fprintf(stderr, "exit: %s: numeric argument required\n", argv[1]);
+			return -1;
+		}
+		status = n & 0xff;
+	}
 
-	exit(0);
+	if(shell_is_interactive)
+		printf("logout\n");
+
+	exit(status);
 }
 
 
@@ -109,6 +203,112 @@ bc_do_history (int argc, char ** argv)
 }
 
 
+#define RSEARCH_MAX	256			/* longest search string */
+#define CTRL(c)		((c) & 0x1f)
+
+/* Show the search string and the entry it found on the current line. */
+static
+void
+show_rsearch (const char * query, size_t len, int match, int failed)
+{
+	printf("\r\033[K(%sreverse-i-search)`%.*s': %s", failed ? "failed " : "", 
+	       (int) len, query, match ? get_hist(match) : "");
+	fflush(stdout);
+}
+
+
+static
+int
+bc_do_rsearch (int argc, char ** argv)
+{
+	struct termios saved, raw;
+	char query[RSEARCH_MAX];
+	size_t len = 0;
+	int top;			/* search below the entry of this command */
+	int match = 0;		/* number of the entry shown, 0 if none */
+	int failed = 0;		/* the search string is not found */
+	int accepted = 0;
+
+	if(argc > 2){
+		fprintf(stderr, "rsearch: too many arguments\n");
+		return -1;
+	}
+	if(!shell_is_interactive){
+		fprintf(stderr, "rsearch: the shell is not interactive\n");
+		return -1;
+	}
+
+	top = count_hist();
+	if(argc == 2){
+		len = strlen(argv[1]);
+		if(len > RSEARCH_MAX)
+			len = RSEARCH_MAX;
+		memcpy(query, argv[1], len);
+		failed = ((match = search_hist(query, len, 0, top)) == 0);
+	}
+
+	if(tcgetattr(STDIN_FILENO, &saved) == -1){
+		perror("rsearch");
+		return -1;
+	}
+	raw = saved;
+	raw.c_lflag &= ~(ICANON | ECHO | ISIG);
+	raw.c_cc[VMIN] = 1;
+	raw.c_cc[VTIME] = 0;
+	if(tcsetattr(STDIN_FILENO, TCSANOW, &raw) == -1){
+		perror("rsearch");
+		return -1;
+	}
+
+	for(;;){
+		unsigned char c;
+		ssize_t n;
+		int next;
+
+		show_rsearch(query, len, match, failed);
+		if((n = read(STDIN_FILENO, &c, 1)) == -1 && errno == EINTR)
+			continue;
+		if(n <= 0)
+			break;
+
+		if(c == '\n' || c == '\r'){
+			accepted = 1;
+			break;
+		}else if(c == CTRL('G') || c == CTRL('C') || c == '\033'){
+			break;
+		}else if(c == CTRL('R')){	/* the next older match */
+			if(len > 0 && match > 0){
+				if((next = search_hist(query, len, 0, match)) != 0)
+					match = next;
+				failed = (next == 0);
+			}
+		}else if(c == 0x7f || c == '\b'){	/* start again with the shorter string */
+			if(len > 0)
+				len--;
+			match = (len > 0) ? search_hist(query, len, 0, top) : 0;
+			failed = (len > 0 && match == 0);
+		}else if(c >= ' ' && len < RSEARCH_MAX){	/* the shown entry, or an older one */
+			query[len++] = c;
+			if((next = search_hist(query, len, 0, match ? match + 1 : top)) != 0)
+				match = next;
+			failed = (next == 0);
+		}
+	}
+
+	tcsetattr(STDIN_FILENO, TCSANOW, &saved);
+	printf("\r\033[K");
+
+	if(accepted && match > 0){
+		char *line = get_hist(match);
+		printf("%s\n", line);
+		push_cmd(line);
+	}
+	fflush(stdout);
+
+	return 1;
+}
+
+
 static
 int
 bc_do_set (int argc, char ** argv)
@@ -120,34 +320,16 @@ bc_do_set (int argc, char ** argv)
 
 	if(argc == 1){
 		print_variable_list();
+	}else if(argc == 2 && (strcmp(argv[1], "-b") == 0 || strcmp(argv[1], "+b") == 0)){
+		set_notify(argv[1][0] == '-');
 	}else if(argc == 2){
 		char *value = get_value_by_name(argv[1]);
 		if(value != NULL)
 			printf("%s\n", value);
 	}else if(argc == 3){
-		variable *var;
-		if((var = get_variable(argv[1])) != NULL){	/* update variable */
-			free(var -> value);
-
-			size_t len = strlen(argv[2]);
-			char *new_value = emalloc(len + 1);
-			strncpy(new_value, argv[2], len);
-			new_value[len] = '\0';
-
-			var -> value = new_value;
-		}else{	/* create a new variable */
-			size_t len = strlen(argv[1]);
-			char *name = emalloc(len + 1);
-			strncpy(name, argv[1], len);
-			name[len] = '\0';
-
-			len = strlen(argv[2]);
-			char *value = emalloc(len + 1);
-			strncpy(value, argv[2], len);
-			value[len] = '\0';
-
-			add_variable(name, value);
-		}
+		set_variable(argv[1], argv[2]);
+		if(snapshot_recording)
+			snapshot_record(SNAP_SET, argv[1], argv[2]);
 	}
 
 	return 1;
@@ -158,22 +340,83 @@ static
 int
 bc_do_unset (int argc, char ** argv)
 {
-	if(argc == 1){
+	int only_export = (argc > 1 && strcmp(argv[1], "-x") == 0);
+
+	if(argc == 1 + only_export){
 		fprintf(stderr, "unset: missing argument\n");
 		return -1;
 	}
 
-	if(argc >= 3){
+	if(argc >= 3 + only_export){
 		fprintf(stderr, "unset: too many arguments\n");
 		return -1;
 	}
 
-	delete_variable(argv[1]);
+	if(only_export)
+		unexport_variable(argv[2]);
+	else
+		delete_variable(argv[1]);
+	if(snapshot_recording)
+		snapshot_record(only_export ? SNAP_UNEXPORT : SNAP_UNSET, argv[1 + only_export], NULL);
 
 	return 1;	
 }
 
 
+/* Return the length of the variable name ([A-Za-z_][A-Za-z0-9_]*) that s starts with, 
+ * 0 if there is none.
+ */
+static
+size_t
+name_len (const char * s)
+{
+	size_t n = 0;
+
+	if((*s >= '0' && *s <= '9'))
+		return 0;
+	while(s[n] == '_' || (s[n] >= 'a' && s[n] <= 'z') || (s[n] >= 'A' && s[n] <= 'Z')
+	      || (s[n] >= '0' && s[n] <= '9'))
+		n++;
+	return n;
+}
+
+
+static
+int
+bc_do_export (int argc, char ** argv)
+{
+	if(argc == 1){
+		print_export_list();
+		return 1;
+	}
+
+	int rv = 1;
+	int i;
+	for(i = 1; i < argc; i++){
+		char *eq = strchr(argv[i], '=');
+		size_t n = name_len(argv[i]);
+		if(n == 0 || (argv[i][n] != '\0' && &argv[i][n] != eq)){
+			fprintf(stderr, "export: %s: not a valid name\n", argv[i]);
+			rv = -1;
+			continue;
+		}
+		if(eq != NULL){
+			*eq = '\0';	/* argv[i] is owned by the job */
+			set_variable(argv[i], eq + 1);
+			if(snapshot_recording)
+				snapshot_record(SNAP_SET, argv[i], eq + 1);
+		}
+		if(export_variable(argv[i]) == -1){
+			fprintf(stderr, "export: %s: no such variable\n", argv[i]);
+			rv = -1;
+		}else if(snapshot_recording)
+			snapshot_record(SNAP_EXPORT, argv[i], NULL);
+	}
+
+	return rv;
+}
+
+
 static
 int
 bc_do_pwd (int argc, char ** argv)
@@ -220,51 +463,85 @@ bc_do_cd (int argc, char ** argv)
 		perror("chdir");
 		return -1;
 	}
+	cwd_changed();
 
 	return 1;
 }
 
 
+static
+int
+bc_do_hash (int argc, char ** argv)
+{
+	int i, rv = 1;
+
+	if(argc == 1){
+		print_path_cache();
+		return 1;
+	}
+
+	i = 1;
+	if(strcmp(argv[1], "-r") == 0){
+		clear_path_cache();
+		i++;
+	}
+	for(; i < argc; i++){
+		if(hash_command(argv[i]) == -1){
+			fprintf(stderr, "hash: %s: not found\n", argv[i]);
+			rv = -1;
+		}
+	}
+
+	return rv;
+}
+
+
 static
 int bc_do_jobs (int argc, char ** argv)
 {
-	if(argc > 1){
-		fprintf(stderr, "jobs: too many arguments\n");
+	int verbose = (argc == 2 && strcmp(argv[1], "-v") == 0);
+
+	if(argc > 2 || (argc == 2 && !verbose)){
+		fprintf(stderr, "jobs: usage: jobs [-v]\n");
 		return -1;
 	}
 
-	job *j, *jlast, *jnext;
+	job *j, *jnext;
 
 	/* Update status information for child processes. */
 	update_status();
 
-	jlast = NULL;
+	if(verbose)
+		print_finished_jobs();
+
 	for(j = first_job; j; j = jnext)
 	{
     	jnext = j->next;
 
- 		if(j == current_job){
- 			jlast = j;
+ 		if(j == current_job)
 			continue;
- 		}
 
-    	if(job_is_completed(j)){
+    	if(job_is_queued(j)){
+    		format_job_info(j, "Queued");
+    	}else if(job_is_completed(j)){
     		format_job_info(j, "Completed");
-    		if(jlast)
-        		jlast->next = jnext;
-        	else
-        		first_job = jnext;
-        	free_job(j);
+    		if(verbose)
+    			print_job_times(j);
+        	remove_job(j);
     	}else if(job_is_stopped(j)){
         	format_job_info(j, "Stopped");
+    		if(verbose)
+    			print_job_times(j);
         	j->notified = 1;
-        	jlast = j;
     	}else{
         	format_job_info(j, "Running");
-        	jlast = j;
+    		if(verbose)
+    			print_job_times(j);
     	}
     }
 
+	print_job_slots();
+
 	return 1;
 }
 
@@ -326,63 +603,1420 @@ bc_do_bg (int argc, char ** argv)
 	return 1;
 }
 
-/* $end handler */
+static
+int
+bc_do_meminfo (int argc, char ** argv)
+{
+	if(argc > 1){
+		fprintf(stderr, "meminfo: too many arguments\n");
+		return -1;
+	}
+
+	const arena_stats *st = get_arena_stats();
+	size_t reserved = st -> bytes_reserved;
 
+	printf("arenas:   %lu live\n", st -> arenas);
+	printf("allocs:   %lu\n", st -> allocs);
+	printf("blocks:   %lu from malloc, %lu reused\n", st -> mallocs, st -> reuses);
+	printf("used:     %zu of %zu bytes (%.1f%%)\n", st -> bytes_used, reserved, 
+	       reserved ? 100.0 * st -> bytes_used / reserved : 0.0);
+	printf("wasted:   %zu bytes in block tails\n", st -> bytes_wasted);
+	printf("cached:   %zu bytes in free blocks\n", st -> bytes_cached);
+
+	return 1;
+}
 
 static
-bc_entry bc_list[] = {
-	FORALL_BC(ADD_BC_ENTRY)
-	{NULL, NULL}
-};
+int
+bc_do_cmdcache (int argc, char ** argv)
+{
+	if(argc > 2){
+		fprintf(stderr, "cmdcache: too many arguments\n");
+		return -1;
+	}
 
+	if(argc == 2){
+		if(strcmp(argv[1], "-c") != 0){
+			fprintf(stderr, "cmdcache: %s: invalid option\n", argv[1]);
+			return -1;
+		}
+		clear_cmdcache();
+		return 1;
+	}
+
+	print_cmdcache_stats();
+
+	return 1;
+}
 
+
+/* The shell has no quoting, so a value that starts with a quote goes on until the 
+ * word that ends with the same quote: alias ll='ls -l --color' gives "ls -l --color".
+ */
+static
 int
-builtin_cmd (job * j)
+bc_do_alias (int argc, char ** argv)
 {
-	/* The case that the pointer p is NULL should be handled before the function is called, 
-	 * that is, the function assumes that the pointer is p not NULL.
-	 */
-	int count = 1;
-	process *p = j -> first_process;
-	while(p -> next != NULL){
-		count++;
-		p = p -> next;
+	int rv = 1;
+	int i;
+
+	if(argc == 1){
+		print_alias_list();
+		return 1;
 	}
 
-	if(count != 1 || (p -> argv)[0] == NULL)
-		return 0;	/* not a builtin command */
+	for(i = 1; i < argc; i++){
+		char *eq = strchr(argv[i], '=');
+		if(eq == NULL){
+			if(print_alias(argv[i]) == -1){
+				fprintf(stderr, "alias: %s: not found\n", argv[i]);
+				rv = -1;
+			}
+			continue;
+		}
 
-	int argc = 0;
-	while((p -> argv)[argc] != NULL)
-		argc++;
+		*eq = '\0';	/* argv[i] is owned by the job */
+		char *name = argv[i], *value = eq + 1;
+		char quote = (*value == '\'' || *value == '"') ? *value : '\0';
+		char buf[BUF_SIZE];
+		size_t len = 0;
+
+		if(quote){
+			/* join the words up to the closing quote */
+			const char *w = value + 1;
+			for(;;){
+				size_t n = strlen(w);
+				int last = (n > 0 && w[n - 1] == quote);
+				if(last)
+					n--;
+				if(len + n + 2 > sizeof(buf)){
+					fprintf(stderr, "alias: %s: value too long\n", name);
+					return -1;
+				}
+				if(len > 0)
+					buf[len++] = ' ';
+				memcpy(buf + len, w, n);
+				len += n;
+				if(last)
+					break;
+				if(++i == argc){
+					fprintf(stderr, "alias: %s: missing closing %c\n", name, quote);
+					return -1;
+				}
+				w = argv[i];
+			}
+			buf[len] = '\0';
+			value = buf;
+		}
 
-	int rv = 0;
-	bc_entry *ep = bc_list;
-	while(ep -> name != NULL){
-		if(strcmp((p -> argv)[0], ep -> name) == 0){
-			rv = (ep -> handler)(argc, p -> argv);
-			break;
+		if(set_alias(name, value) == -1)
+			rv = -1;
+		else if(snapshot_recording)
+			snapshot_record(SNAP_ALIAS, name, value);
+	}
+
+	return rv;
+}
+
+
+static
+int
+bc_do_unalias (int argc, char ** argv)
+{
+	int rv = 1;
+	int i;
+
+	if(argc == 1){
+		fprintf(stderr, "unalias: missing argument\n");
+		return -1;
+	}
+
+	if(strcmp(argv[1], "-a") == 0){
+		if(argc > 2){
+			fprintf(stderr, "unalias: too many arguments\n");
+			return -1;
 		}
-		++ep;
+		clear_aliases();
+		if(snapshot_recording)
+			snapshot_record(SNAP_UNALIAS_ALL, "", NULL);
+		return 1;
 	}
 
-	if(ep -> name == NULL)
-		return 0;	/* not a builtin command */
+	for(i = 1; i < argc; i++){
+		if(remove_alias(argv[i]) == -1){
+			fprintf(stderr, "unalias: %s: not found\n", argv[i]);
+			rv = -1;
+		}else if(snapshot_recording)
+			snapshot_record(SNAP_UNALIAS, argv[i], NULL);
+	}
+
+	return rv;
+}
 
-	/* free job */
-	free_job(j);
 
-	if(first_job == current_job){
-		first_job = NULL;
+static
+int
+bc_do_trace (int argc, char ** argv)
+{
+	if(argc == 1){
+		print_trace_stats();
+		return 1;
+	}
+
+	if(strcmp(argv[1], "on") == 0 && argc <= 3){
+		long size = 0;
+		if(argc == 3){
+			char *end;
+			size = strtol(argv[2], &end, 10);
+			if(*end != '\0' || size <= 0 || size > TRACE_SIZE_MAX){
+				fprintf(stderr, "trace: %s: invalid number of events\n", argv[2]);
+				return -1;
+			}
+		}
+		trace_start(size);
+	}else if(argc > 2){
+		fprintf(stderr, "trace: too many arguments\n");
+		return -1;
+	}else if(strcmp(argv[1], "off") == 0){
+		trace_stop();
+	}else if(strcmp(argv[1], "clear") == 0){
+		trace_clear();
+	}else if(strcmp(argv[1], "dump") == 0){
+		trace_dump(stdout);
 	}else{
-		job *jp = first_job;
-		while((jp -> next) != current_job)
-			jp = jp -> next;
-		jp -> next = NULL;
+		fprintf(stderr, "trace: %s: invalid option\n", argv[1]);
+		return -1;
+	}
+
+	return 1;
+}
+
+/* Return the character of the backslash escape at *sp ((*sp)[0] == '\\') and advance 
+ * *sp past it, or return -1 for \c. An octal escape is \0nnn in the form of echo and %b 
+ * (is_b), and \nnn in a printf format. An unknown escape is the backslash itself.
+ */
+static
+int
+get_escape (const char ** sp, int is_b)
+{
+	const char *s = *sp + 1;
+	int c, n;
+
+	switch(*s){
+		case 'a':  c = '\a'; break;
+		case 'b':  c = '\b'; break;
+		case 'f':  c = '\f'; break;
+		case 'n':  c = '\n'; break;
+		case 'r':  c = '\r'; break;
+		case 't':  c = '\t'; break;
+		case 'v':  c = '\v'; break;
+		case '\\': c = '\\'; break;
+		case 'c':
+			if(!is_b)
+				goto unknown;
+			*sp = s + 1;
+			return -1;
+		case '0': case '1': case '2': case '3': case '4': case '5': case '6': case '7':
+			if(is_b && *s != '0')
+				goto unknown;
+			if(is_b)
+				s++;
+			for(c = 0, n = 0; n < 3 && *s >= '0' && *s <= '7'; n++, s++)
+				c = c * 8 + (*s - '0');
+			*sp = s;
+			return c & 0xff;
+		default:
+		unknown:
+			*sp = s;
+			return '\\';
+	}
+	*sp = s + 1;
+	return c;
+}
+
+
+/* Write s to stdout, expanding the backslash escapes of echo -e. 
+ * Return -1 if the output was stopped by \c.
+ */
+static
+int
+put_escaped (const char * s)
+{
+	int c;
+
+	while(*s != '\0'){
+		if(*s != '\\'){
+			putchar(*s++);
+			continue;
+		}
+		if((c = get_escape(&s, 1)) == -1)
+			return -1;
+		putchar(c);
+	}
+	return 0;
+}
+
+
+static
+int
+bc_do_echo (int argc, char ** argv)
+{
+	int newline = 1, escapes = 0;
+	int i;
+
+	/* Options are only recognized before the first operand, and only if 
+	 * every letter is one of n, e and E, as with bash.
+	 */
+	for(i = 1; i < argc && argv[i][0] == '-' && argv[i][1] != '\0'; i++){
+		const char *o = &argv[i][1];
+		if(o[strspn(o, "neE")] != '\0')
+			break;
+		for(; *o; o++){
+			if(*o == 'n')
+				newline = 0;
+			else
+				escapes = (*o == 'e');
+		}
 	}
-	job_id--;
 
-	return rv;	/* is a builtin command : return 1 if success, return -1 if failed */
+	for(; i < argc; i++){
+		if(escapes){
+			if(put_escaped(argv[i]) == -1)
+				return 1;
+		}else
+			fputs(argv[i], stdout);
+		if(i + 1 < argc)
+			putchar(' ');
+	}
+	if(newline)
+		putchar('\n');
+
+	return 1;
+}
+
+
+/* Convert the printf argument arg to a number. A leading quote gives the 
+ * value of the next character. Return -1 (with a message) if arg is not a number.
+ */
+static
+int
+printf_number (const char * arg, intmax_t * val)
+{
+	char *end;
+
+	*val = 0;
+	if(arg == NULL)
+		return 0;
+	if(arg[0] == '\'' || arg[0] == '"'){
+		*val = (unsigned char) arg[1];
+		return 0;
+	}
+
+	errno = 0;
+	*val = strtoimax(arg, &end, 0);
+	if(end == arg || *end != '\0'){
+		fprintf(stderr, "printf: %s: invalid number\n", arg);
+		return -1;
+	}
+	if(errno == ERANGE){
+		fprintf(stderr, "printf: %s: %s\n", arg, strerror(errno));
+		return -1;
+	}
+	return 0;
+}
+
+
+static
+int
+bc_do_printf (int argc, char ** argv)
+{
+	if(argc < 2){
+		fprintf(stderr, "printf: missing format\n");
+		return -1;
+	}
+
+	const char *fmt = argv[1];
+	char **args = &argv[2];
+	int nargs = argc - 2, ai = 0, first;
+	int rv = 1;
+
+	/* The format is reused as long as it consumes some of the arguments. */
+	do{
+		const char *f = fmt;
+		first = ai;
+
+		while(*f != '\0'){
+			int c;
+			if(*f == '\\'){
+				putchar(get_escape(&f, 0));
+				continue;
+			}
+			if(*f != '%'){
+				putchar(*f++);
+				continue;
+			}
+			if(f[1] == '%'){
+				putchar('%');
+				f += 2;
+				continue;
+			}
+
+			/* copy the flags, width and precision into spec, with '*' replaced by its argument */
+			char spec[64];
+			size_t n = 0;
+			intmax_t val;
+			spec[n++] = *f++;
+			while(*f != '\0' && strchr("-+ #0", *f) != NULL && n < 8)
+				spec[n++] = *f++;
+			for(c = 0; c < 2; c++){
+				if(c == 1){
+					if(*f != '.')
+						break;
+					spec[n++] = *f++;
+				}
+				if(*f == '*'){
+					if(printf_number(ai < nargs ? args[ai++] : NULL, &val) == -1)
+						rv = -1;
+					n += snprintf(&spec[n], 16, "%d", (int) val);
+					f++;
+				}else{
+					while(*f >= '0' && *f <= '9' && n < 40)
+						spec[n++] = *f++;
+				}
+			}
+
+			const char *arg = (ai < nargs) ? args[ai++] : NULL;
+			switch(c = *f++){
+				case 's':
+					spec[n++] = 's';
+					spec[n] = '\0';
+					printf(spec, arg ? arg : "");
+					break;
+				case 'b': {
+					/* expand the escapes into a copy of arg, which is never longer */
+					const char *s = arg ? arg : "";
+					char *buf = emalloc(strlen(s) + 1);
+					size_t len = 0;
+					int stop = 0;
+					while(*s != '\0'){
+						if(*s != '\\')
+							buf[len++] = *s++;
+						else if((c = get_escape(&s, 1)) == -1){
+							stop = 1;
+							break;
+						}else
+							buf[len++] = c;
+					}
+					buf[len] = '\0';
+					if(n == 1){
+						fwrite(buf, 1, len, stdout);
+					}else{
+						spec[n++] = 's';
+						spec[n] = '\0';
+						printf(spec, buf);
+					}
+					free(buf);
+					if(stop)
+						return rv;
+					break;
+				}
+				case 'c':
+					if(arg == NULL || arg[0] == '\0')
+						break;
+					spec[n++] = 'c';
+					spec[n] = '\0';
+					printf(spec, arg[0]);
+					break;
+				case 'd': case 'i':
+				case 'o': case 'u': case 'x': case 'X':
+					if(printf_number(arg, &val) == -1)
+						rv = -1;
+					spec[n++] = 'j';
+					spec[n++] = c;
+					spec[n] = '\0';
+					if(c == 'd' || c == 'i')
+						printf(spec, val);
+					else
+						printf(spec, (uintmax_t) val);
+					break;
+				case 'e': case 'E': case 'f': case 'F': 
+				case 'g': case 'G': case 'a': case 'A': {
+					double d = 0;
+					char *end;
+					if(arg != NULL){
+						d = strtod(arg, &end);
+						if(end == arg || *end != '\0'){
+							fprintf(stderr, "printf: %s: invalid number\n", arg);
+							rv = -1;
+						}
+					}
+					spec[n++] = c;
+					spec[n] = '\0';
+					printf(spec, d);
+					break;
+				}
+				case '\0':
+					fprintf(stderr, "printf: %s: missing conversion character\n", fmt);
+					return -1;
+				default:
+					fprintf(stderr, "printf: %%%c: invalid conversion\n", c);
+					return -1;
+			}
+		}
+	}while(ai < nargs && ai > first);
+
+	return rv;
+}
+
+
+/* The expression of test is parsed by recursive descent over these. */
+static char **test_argv;
+static int test_argc;
+static int test_pos;
+static int test_error;
+
+static int test_or (void);
+
+
+/* Convert the integer operand s of test. */
+static
+long
+test_integer (const char * s)
+{
+	char *end;
+	long val;
+
+	errno = 0;
+	val = strtol(s, &end, 10);
+	while(*end == ' ' || *end == '\t')
+		end++;
+	if(end == s || *end != '\0' || errno == ERANGE){
+		if(!test_error)
+			fprintf(stderr, "test: %s: integer expression expected\n", s);
+		test_error = 1;
+	}
+	return val;
+}
+
+
+static
+int
+test_unary (const char * op, const char * arg)
+{
+	struct stat st;
+
+	switch(op[1]){
+		case 'z':  return arg[0] == '\0';
+		case 'n':  return arg[0] != '\0';
+		case 't':  return isatty((int) test_integer(arg));
+		case 'r':  return access(arg, R_OK) == 0;
+		case 'w':  return access(arg, W_OK) == 0;
+		case 'x':  return access(arg, X_OK) == 0;
+		case 'h':
+		case 'L':  return lstat(arg, &st) == 0 && S_ISLNK(st.st_mode);
+	}
+
+	if(stat(arg, &st) == -1)
+		return 0;
+	switch(op[1]){
+		case 'e':  return 1;
+		case 'f':  return S_ISREG(st.st_mode);
+		case 'd':  return S_ISDIR(st.st_mode);
+		case 'b':  return S_ISBLK(st.st_mode);
+		case 'c':  return S_ISCHR(st.st_mode);
+		case 'p':  return S_ISFIFO(st.st_mode);
+		case 'S':  return S_ISSOCK(st.st_mode);
+		case 's':  return st.st_size > 0;
+		case 'g':  return (st.st_mode & S_ISGID) != 0;
+		case 'u':  return (st.st_mode & S_ISUID) != 0;
+	}
+	return 0;
+}
+
+
+static
+int
+test_is_unary (const char * s)
+{
+	return s[0] == '-' && s[1] != '\0' && s[2] == '\0' && strchr("zntrwxhLefdbcpSsgu", s[1]) != NULL;
+}
+
+
+/* Return the index of the binary operator s in the table below, or -1. */
+static const char *test_binops[] = {
+	"=", "==", "!=", "<", ">", "-eq", "-ne", "-lt", "-le", "-gt", "-ge", "-nt", "-ot", "-ef", NULL
+};
+
+static
+int
+test_binop (const char * s)
+{
+	int i;
+
+	for(i = 0; test_binops[i] != NULL; i++)
+		if(strcmp(s, test_binops[i]) == 0)
+			return i;
+	return -1;
+}
+
+
+static
+int
+test_binary (int op, const char * a, const char * b)
+{
+	struct stat sa, sb;
+	int ra, rb;
+
+	switch(op){
+		case 0:
+		case 1:  return strcmp(a, b) == 0;
+		case 2:  return strcmp(a, b) != 0;
+		case 3:  return strcmp(a, b) < 0;
+		case 4:  return strcmp(a, b) > 0;
+	}
+	if(op <= 10){
+		long x = test_integer(a), y = test_integer(b);
+		switch(op){
+			case 5:  return x == y;
+			case 6:  return x != y;
+			case 7:  return x < y;
+			case 8:  return x <= y;
+			case 9:  return x > y;
+			default: return x >= y;
+		}
+	}
+
+	ra = stat(a, &sa);
+	rb = stat(b, &sb);
+	switch(op){
+		case 11:  return ra == 0 && (rb == -1 || sa.st_mtime > sb.st_mtime);
+		case 12:  return rb == 0 && (ra == -1 || sa.st_mtime < sb.st_mtime);
+		default:  return ra == 0 && rb == 0 && sa.st_dev == sb.st_dev && sa.st_ino == sb.st_ino;
+	}
+}
+
+
+/* primary : '(' expr ')' | unary-op arg | arg binary-op arg | arg */
+static
+int
+test_primary (void)
+{
+	char **av = &test_argv[test_pos];
+	int left = test_argc - test_pos;
+	int op, rv;
+
+	if(left <= 0){
+		if(!test_error)
+			fprintf(stderr, "test: argument expected\n");
+		test_error = 1;
+		return 0;
+	}
+
+	if(left >= 3 && (op = test_binop(av[1])) != -1){
+		test_pos += 3;
+		return test_binary(op, av[0], av[2]);
+	}
+	if(strcmp(av[0], "(") == 0){
+		test_pos++;
+		rv = test_or();
+		if(test_pos >= test_argc || strcmp(test_argv[test_pos], ")") != 0){
+			if(!test_error)
+				fprintf(stderr, "test: ')' expected\n");
+			test_error = 1;
+			return 0;
+		}
+		test_pos++;
+		return rv;
+	}
+	if(left >= 2 && test_is_unary(av[0])){
+		test_pos += 2;
+		return test_unary(av[0], av[1]);
+	}
+	test_pos++;
+	return av[0][0] != '\0';
+}
+
+
+/* not : '!' not | primary */
+static
+int
+test_not (void)
+{
+	/* "! = x" compares "!" with "x" */
+	if(test_pos < test_argc && strcmp(test_argv[test_pos], "!") == 0
+	   && !(test_argc - test_pos >= 3 && test_binop(test_argv[test_pos + 1]) != -1)){
+		test_pos++;
+		return !test_not();
+	}
+	return test_primary();
+}
+
+
+/* and : not { '-a' not } */
+static
+int
+test_and (void)
+{
+	int rv = test_not();
+
+	while(test_pos < test_argc && strcmp(test_argv[test_pos], "-a") == 0){
+		test_pos++;
+		rv = test_not() && rv;
+	}
+	return rv;
+}
+
+
+/* or : and { '-o' and } */
+static
+int
+test_or (void)
+{
+	int rv = test_and();
+
+	while(test_pos < test_argc && strcmp(test_argv[test_pos], "-o") == 0){
+		test_pos++;
+		rv = test_and() || rv;
+	}
+	return rv;
+}
+
+
+/* Evaluate the expression of the n arguments av. Up to four arguments are 
+ * taken apart by their number, as specified by POSIX; longer ones are parsed.
+ */
+static
+int
+test_expr (int n, char ** av)
+{
+	int rv;
+
+	test_argv = av;
+	test_argc = n;
+	test_pos = 0;
+	test_error = 0;
+
+	switch(n){
+		case 0:
+			return 0;
+		case 1:
+			return av[0][0] != '\0';
+		case 2:
+			if(strcmp(av[0], "!") == 0)
+				return av[1][0] == '\0';
+			if(test_is_unary(av[0]))
+				return test_unary(av[0], av[1]);
+			break;
+		case 3:
+			if(test_binop(av[1]) != -1)
+				return test_binary(test_binop(av[1]), av[0], av[2]);
+			if(strcmp(av[1], "-a") == 0 || strcmp(av[1], "-o") == 0)
+				break;
+			if(strcmp(av[0], "!") == 0)
+				return !test_expr(2, &av[1]);
+			if(strcmp(av[0], "(") == 0 && strcmp(av[2], ")") == 0)
+				return av[1][0] != '\0';
+			break;
+		case 4:
+			if(strcmp(av[0], "!") == 0)
+				return !test_expr(3, &av[1]);
+			if(strcmp(av[0], "(") == 0 && strcmp(av[3], ")") == 0)
+				return test_expr(2, &av[1]);
+			break;
+	}
+
+	rv = test_or();
+	if(!test_error && test_pos < test_argc){
+		fprintf(stderr, "test: %s: unexpected argument\n", test_argv[test_pos]);
+		test_error = 1;
+	}
+	return rv;
+}
+
+
+/* test returns 1 if the expression is true, 0 if it is false, and -2 on error (status 2). */
+static
+int
+bc_do_test (int argc, char ** argv)
+{
+	int rv = test_expr(argc - 1, &argv[1]);
+
+	if(test_error)
+		return -2;
+	return rv;
+}
+
+
+static
+int
+bc_do_bracket (int argc, char ** argv)
+{
+	if(strcmp(argv[argc - 1], "]") != 0){
+		fprintf(stderr, "[: missing ']'\n");
+		return -2;
+	}
+	return bc_do_test(argc - 1, argv);
+}
+
+
+static
+int
+bc_do_true (int argc, char ** argv)
+{
+	return 1;
+}
+
+
+static
+int
+bc_do_false (int argc, char ** argv)
+{
+	return 0;
+}
+
+
+/* let evaluates integer expressions, so that loops can count without running expr:
+ *   expr   : term { ('+' | '-') term }
+ *   term   : factor { ('*' | '/' | '%') factor }
+ *   factor : ('+' | '-') factor | '(' expr ')' | number | name
+ * A name stands for the value of the variable, 0 if it is not set.
+ */
+static const char *let_pos;
+static int let_error;
+
+static long let_expr (void);
+
+
+static
+void
+let_blanks (void)
+{
+	let_pos += strspn(let_pos, " \t");
+}
+
+
+/* Report the first error of an expression. */
+static
+void
+let_fail (const char * msg)
+{
+	if(!let_error)
+		fprintf(stderr, "let: %s\n", msg);
+	let_error = 1;
+}
+
+
+static
+long
+let_factor (void)
+{
+	long v;
+	size_t n;
+	char *end;
+
+	let_blanks();
+	if(*let_pos == '-' || *let_pos == '+'){
+		char sign = *let_pos++;
+		v = let_factor();
+		if(sign == '-' && __builtin_sub_overflow(0, v, &v))
+			let_fail("integer overflow");
+		return v;
+	}
+	if(*let_pos == '('){
+		let_pos++;
+		v = let_expr();
+		let_blanks();
+		if(*let_pos != ')'){
+			let_fail("')' expected");
+			return 0;
+		}
+		let_pos++;
+		return v;
+	}
+	if(*let_pos >= '0' && *let_pos <= '9'){
+		errno = 0;
+		v = strtol(let_pos, &end, 0);
+		if(errno == ERANGE)
+			let_fail("integer overflow");
+		let_pos = end;
+		return v;
+	}
+	if((n = name_len(let_pos)) > 0){
+		char name[n + 1];
+		memcpy(name, let_pos, n);
+		name[n] = '\0';
+		let_pos += n;
+		char *value = get_value_by_name(name);
+		if(value == NULL || *value == '\0')
+			return 0;
+		errno = 0;
+		v = strtol(value, &end, 0);
+		if(errno == ERANGE){
+			let_fail("integer overflow");
+		}else if(end == value || *end != '\0'){
+			if(!let_error)
+				fprintf(stderr, "let: %s: %s: not an integer\n", name, value);
+			let_error = 1;
+		}
+		return v;
+	}
+	if(!let_error)
+		fprintf(stderr, "let: %s: syntax error\n", (*let_pos != '\0') ? let_pos : "missing operand");
+	let_error = 1;
+	return 0;
+}
+
+
+static
+long
+let_term (void)
+{
+	long v = let_factor(), w;
+
+	for(let_blanks(); *let_pos == '*' || *let_pos == '/' || *let_pos == '%'; let_blanks()){
+		char op = *let_pos++;
+		w = let_factor();
+		if(op == '*'){
+			if(__builtin_mul_overflow(v, w, &v))
+				let_fail("integer overflow");
+		}else if(w == 0){
+			let_fail("division by 0");
+		}else if(v == LONG_MIN && w == -1){
+			let_fail("integer overflow");	/* the quotient does not fit, and x86 traps */
+		}else{
+			v = (op == '/') ? v / w : v % w;
+		}
+	}
+	return v;
+}
+
+
+static
+long
+let_expr (void)
+{
+	long v = let_term();
+
+	for(let_blanks(); *let_pos == '+' || *let_pos == '-'; let_blanks()){
+		char op = *let_pos++;
+		long w = let_term();
+		if((op == '+') ? __builtin_add_overflow(v, w, &v) : __builtin_sub_overflow(v, w, &v))
+			let_fail("integer overflow");
+	}
+	return v;
+}
+
+
+static
+int
+bc_do_let (int argc, char ** argv)
+{
+	long v = 0;
+	int i;
+
+	if(argc == 1){
+		fprintf(stderr, "let: missing argument\n");
+		return -1;
+	}
+
+	for(i = 1; i < argc; i++){
+		size_t n = name_len(argv[i]);
+		int assign = (n > 0 && argv[i][n] == '=');
+
+		let_pos = assign ? &argv[i][n + 1] : argv[i];
+		let_error = 0;
+		v = let_expr();
+		if(!let_error && *let_pos != '\0'){
+			fprintf(stderr, "let: %s: syntax error\n", let_pos);
+			let_error = 1;
+		}
+		if(let_error)
+			return -1;
+
+		if(assign){
+			char name[n + 1], value[24];
+			memcpy(name, argv[i], n);
+			name[n] = '\0';
+			snprintf(value, sizeof(value), "%ld", v);
+			set_variable(name, value);
+			if(snapshot_recording)
+				snapshot_record(SNAP_SET, name, value);
+		}
+	}
+	return v != 0;
+}
+
+
+/* time <pipeline> is taken apart by builtin_cmd(); only a bare time, or a time 
+ * in a later stage of a pipeline, gets here.
+ */
+static
+int
+bc_do_time (int argc, char ** argv)
+{
+	struct rusage self, children;
+
+	if(argc > 1){
+		fprintf(stderr, "time: can only time a whole pipeline\n");
+		return -1;
+	}
+
+	getrusage(RUSAGE_SELF, &self);
+	getrusage(RUSAGE_CHILDREN, &children);
+	fprintf(stderr, "%10s %10s %11s\n", "user", "sys", "maxrss");
+	fprintf(stderr, "%10.3f %10.3f %10ldK  shell\n", 
+	        self.ru_utime.tv_sec + self.ru_utime.tv_usec / 1e6, 
+	        self.ru_stime.tv_sec + self.ru_stime.tv_usec / 1e6, self.ru_maxrss);
+	fprintf(stderr, "%10.3f %10.3f %10ldK  children\n", 
+	        children.ru_utime.tv_sec + children.ru_utime.tv_usec / 1e6, 
+	        children.ru_stime.tv_sec + children.ru_stime.tv_usec / 1e6, children.ru_maxrss);
+	return 1;
+}
+
+/* The items of parallel: every {} in the command template is replaced by the item, 
+ * or the item is appended if there is no {}.
+ */
+static volatile sig_atomic_t parallel_interrupted;
+
+static
+void
+parallel_sigint (int sig)
+{
+	parallel_interrupted = 1;
+}
+
+
+/* Build the job that runs the command template tmpl (ntmpl words) for item. The job 
+ * has jid 0 and is not put on the job list. Its standard input is in.
+ */
+static
+job *
+new_item_job (char ** tmpl, int ntmpl, const char * item, int in)
+{
+	size_t item_len = strlen(item);
+	size_t bytes = 0, n;
+	int i, argc = ntmpl, has_braces = 0;
+
+	for(i = 0; i < ntmpl; i++){
+		const char *s;
+		n = strlen(tmpl[i]);
+		for(s = strstr(tmpl[i], "{}"); s != NULL; s = strstr(s + 2, "{}")){
+			n += item_len - 2;
+			has_braces = 1;
+		}
+		bytes += n + 1;
+	}
+	if(!has_braces){
+		argc++;
+		bytes += item_len + 1;
+	}
+
+	arena mem;
+	arena_init(&mem);
+	job *j = arena_alloc(&mem, sizeof(job));
+	process *p = arena_alloc(&mem, sizeof(process));
+	char **argv = arena_alloc(&mem, sizeof(char *) * (argc + 1));
+	char *word = arena_alloc(&mem, bytes);
+	char *command = arena_alloc(&mem, bytes);
+
+	memset(j, 0, sizeof(job));
+	j -> mem = mem;
+	j -> first_process = p;
+	j -> tmodes = shell_tmodes;
+	j -> stdin = in;
+	j -> stdout = STDOUT_FILENO;
+	j -> stderr = STDERR_FILENO;
+	j -> command = command;
+
+	memset(p, 0, sizeof(process));
+	p -> argv = argv;
+	p -> pid = -1;
+
+	for(i = 0; i < argc; i++){
+		const char *s = (i < ntmpl) ? tmpl[i] : item;
+		const char *b;
+		argv[i] = word;
+		while(i < ntmpl && (b = strstr(s, "{}")) != NULL){
+			memcpy(word, s, b - s);
+			word += b - s;
+			memcpy(word, item, item_len);
+			word += item_len;
+			s = b + 2;
+		}
+		n = strlen(s);
+		memcpy(word, s, n + 1);
+		word += n + 1;
+
+		/* the command for messages is the words joined by blanks */
+		n = word - argv[i] - 1;
+		memcpy(command, argv[i], n);
+		command += n;
+		*command++ = (i + 1 < argc) ? ' ' : '\0';
+	}
+	argv[argc] = NULL;
+
+	return j;
+}
+
+
+/* Read the lines of the standard input into an array of items, which are 
+ * stored in *buf. Return the number of items, or -1 on a read error.
+ */
+static
+int
+read_items (char *** items, char ** buf)
+{
+	size_t len = 0, size = BUF_SIZE, count = 0, i;
+	ssize_t n;
+	char *data = emalloc(size);
+
+	for(;;){
+		if(len + 1 == size){
+			size *= 2;
+			data = erealloc(data, size);
+		}
+		n = read(STDIN_FILENO, &data[len], size - len - 1);
+		if(n == 0)
+			break;
+		if(n == -1){
+			if(errno == EINTR)
+				continue;
+			perror("parallel: read");
+			free(data);
+			return -1;
+		}
+		len += n;
+	}
+	if(len > 0 && data[len - 1] != '\n')
+		data[len++] = '\n';		/* there is always room for it */
+
+	for(i = 0; i < len; i++)
+		if(data[i] == '\n')
+			count++;
+	char **list = emalloc(sizeof(char *) * (count + 1));
+	char *line = data;
+	count = 0;
+	for(i = 0; i < len; i++){
+		if(data[i] != '\n')
+			continue;
+		data[i] = '\0';
+		if(*line != '\0')	/* empty lines are no items */
+			list[count++] = line;
+		line = &data[i + 1];
+	}
+
+	*items = list;
+	*buf = data;
+	return count;
+}
+
+
+static
+int
+bc_do_parallel (int argc, char ** argv)
+{
+	long max = sysconf(_SC_NPROCESSORS_ONLN);
+	int verbose = 0;
+	int i = 1;
+
+	for(; i < argc && argv[i][0] == '-'; i++){
+		if(strcmp(argv[i], "-v") == 0){
+			verbose = 1;
+		}else if(strcmp(argv[i], "-j") == 0 && i + 1 < argc){
+			char *end;
+			max = strtol(argv[++i], &end, 10);
+			if(*end != '\0' || max < 1){
+				fprintf(stderr, "parallel: %s: invalid number of jobs\n", argv[i]);
+				return -1;
+			}
+		}else{
+			fprintf(stderr, "parallel: %s: invalid option\n", argv[i]);
+			return -1;
+		}
+	}
+	if(max < 1)
+		max = 1;
+
+	/* the command template, then the items after ::: or from the standard input */
+	char **tmpl = &argv[i];
+	int ntmpl = 0;
+	while(i < argc && strcmp(argv[i], ":::") != 0){
+		ntmpl++;
+		i++;
+	}
+	if(ntmpl == 0){
+		fprintf(stderr, "parallel: missing command\n");
+		return -1;
+	}
+
+	char **items, *buf = NULL;
+	int nitems;
+	if(i < argc){
+		items = &argv[i + 1];
+		nitems = argc - i - 1;
+	}else if((nitems = read_items(&items, &buf)) == -1){
+		return -1;
+	}
+	if(max > nitems)	/* no more items run at a time than there are */
+		max = (nitems > 0) ? nitems : 1;
+
+	/* The items must not compete for the input of the shell, or stop on it. */
+	int devnull = open("/dev/null", O_RDONLY | O_CLOEXEC);
+	if(devnull == -1){
+		perror("parallel: /dev/null");
+		return -1;
+	}
+
+	/* In an interactive shell, Ctrl-C stops launching and terminates the running items. */
+	struct sigaction sa, old_sa;
+	parallel_interrupted = 0;
+	if(shell_is_interactive){
+		memset(&sa, 0, sizeof(sa));
+		sa.sa_handler = parallel_sigint;
+		sigemptyset(&sa.sa_mask);
+		sigaction(SIGINT, &sa, &old_sa);
+	}
+
+	job **running = emalloc(sizeof(job *) * max);
+	int *item_of = emalloc(sizeof(int) * max);
+	long nrunning = 0, k;
+	int next = 0, failed = 0, killed = 0;
+
+	while(next < nitems || nrunning > 0){
+		/* keep max items in flight */
+		while(next < nitems && nrunning < max && !parallel_interrupted){
+			job *j = new_item_job(tmpl, ntmpl, items[next], devnull);
+			start_job(j, 0);
+			item_of[nrunning] = next++;
+			running[nrunning++] = j;
+		}
+		if(parallel_interrupted && !killed){
+			for(k = 0; k < nrunning; k++){
+				job *j = running[k];
+				kill(shell_is_interactive ? - j -> pgid : j -> first_process -> pid, SIGTERM);
+			}
+			killed = 1;
+			next = nitems;
+		}
+		if(nrunning == 0)
+			break;
+
+		wait_for_child();
+
+		/* report the finished items and free their slots for the next ones */
+		for(k = 0; k < nrunning; ){
+			job *j = running[k];
+			if(!job_is_completed(j)){
+				k++;
+				continue;
+			}
+			int status = job_status(j);
+			if(status != 0)
+				failed++;
+			if(verbose || status != 0)
+				fprintf(stderr, "parallel: [%d] exit %d: %s\n", item_of[k] + 1, status, j -> command);
+			free_job(j);
+			nrunning--;
+			running[k] = running[nrunning];
+			item_of[k] = item_of[nrunning];
+		}
+	}
+
+	if(shell_is_interactive)
+		sigaction(SIGINT, &old_sa, NULL);
+	close(devnull);
+	free(running);
+	free(item_of);
+	if(buf != NULL){
+		free(items);
+		free(buf);
+	}
+
+	if(failed > 0 || parallel_interrupted){
+		fprintf(stderr, "parallel: %d of %d items failed%s\n", failed, nitems, 
+		        parallel_interrupted ? ", interrupted" : "");
+		return -1;
+	}
+	return 1;
+}
+
+/* $end handler */
+
+
+static
+bc_entry bc_list[] = {
+	FORALL_BC(ADD_BC_ENTRY)
+	{"[", bc_do_bracket},	/* not a C identifier */
+	{NULL, NULL}
+};
+
+/* The entries of bc_list are looked up by name in an open-addressing hash table (linear 
+ * probing) that is built on first use.
+ */
+#define BC_TABLE_SIZE	64		/* a power of 2, more than twice the number of builtins */
+
+static bc_entry *bc_table[BC_TABLE_SIZE];
+static int bc_table_ready = 0;
+
+
+static
+bc_entry *
+find_builtin (const char * name)
+{
+	size_t mask = BC_TABLE_SIZE - 1;
+	size_t i;
+	bc_entry *ep;
+
+	if(!bc_table_ready){
+		for(ep = bc_list; ep -> name != NULL; ep++){
+			i = hash_bytes(ep -> name, strlen(ep -> name)) & mask;
+			while(bc_table[i] != NULL)
+				i = (i + 1) & mask;
+			bc_table[i] = ep;
+		}
+		bc_table_ready = 1;
+	}
+
+	for(i = hash_bytes(name, strlen(name)) & mask; (ep = bc_table[i]) != NULL; i = (i + 1) & mask)
+		if(strcmp(ep -> name, name) == 0)
+			return ep;
+	return NULL;
+}
+
+
+/* Return true if name is a builtin command. */
+int
+is_builtin (const char * name)
+{
+	return find_builtin(name) != NULL;
+}
+
+
+/* Run the builtin command argv[0] with the current standard I/O channels, 
+ * and return its exit status: 0 on success, 1 on failure or a false test, 2 for a bad test.
+ */
+int
+exec_builtin (char ** argv)
+{
+	bc_entry *ep = find_builtin(argv[0]);
+	int argc = 0;
+
+	while(argv[argc] != NULL)
+		argc++;
+
+	int rv = (ep -> handler)(argc, argv);
+	return (rv == 1) ? 0 : (rv == -2) ? 2 : 1;
+}
+
+
+/* Run the builtin command of p in the shell with its standard input, output and 
+ * error taken from infile, outfile and errfile, or from the files p redirects them to. 
+ * The descriptors of the shell are saved beforehand and restored afterwards. 
+ * Return the exit status of the command, which is also stored in last_status.
+ */
+int
+run_builtin (process * p, int infile, int outfile, int errfile)
+{
+	static const int flags[2] = {O_WRONLY | O_CREAT | O_TRUNC, O_WRONLY | O_CREAT | O_APPEND};
+	int fds[3] = {infile, outfile, errfile};
+	int opened[3] = {-1, -1, -1};
+	int saved[3] = {-1, -1, -1};
+	int i, status = 1;
+	int masked = 0;
+	mode_t mask = 0;
+
+	/* open the redirections first, so that nothing needs to be undone if one fails */
+	for(i = 0; i < 3; i++){
+		char *filename = (p -> io_re)[i].dest;
+		if(filename == NULL)
+			continue;
+		if(!masked){	/* only when needed: a loop of builtins runs this a lot */
+			mask = umask(DEF_UMASK);	/* as the child of fork() does */
+			masked = 1;
+		}
+		if(i == 0)
+			opened[i] = open(filename, O_RDONLY | O_CLOEXEC);
+		else
+			opened[i] = open(filename, flags[(p -> io_re)[i].is_append] | O_CLOEXEC, DEF_MODE);
+		if(opened[i] == -1){
+			fprintf(stderr, "%s: %s\n", filename, strerror(errno));
+			umask(mask);
+			goto out;
+		}
+		fds[i] = opened[i];
+	}
+	if(masked)
+		umask(mask);
+
+	fflush(stdout);
+	for(i = 0; i < 3; i++){
+		if(fds[i] == i)
+			continue;
+		saved[i] = fcntl(i, F_DUPFD_CLOEXEC, 10);	/* -1 if i was closed */
+		dup2(fds[i], i);
+	}
+
+	status = exec_builtin(p -> argv);
+
+	fflush(stdout);
+	for(i = 0; i < 3; i++){
+		if(fds[i] == i)
+			continue;
+		if(saved[i] == -1){
+			close(i);
+		}else{
+			dup2(saved[i], i);
+			close(saved[i]);
+		}
+	}
+
+out:
+	for(i = 0; i < 3; i++)
+		if(opened[i] != -1)
+			close(opened[i]);
+	last_status = status;
+	return status;
+}
+
+
+int
+builtin_cmd (job * j)
+{
+	/* The case that the pointer p is NULL should be handled before the function is called, 
+	 * that is, the function assumes that the pointer is p not NULL.
+	 * Pipelines are left to launch_job(), which runs their builtin stages.
+	 */
+	process *p = j -> first_process;
+	int status;
+
+	/* time <pipeline>: drop the prefix and report the times when the job is done */
+	if((p -> argv)[0] != NULL && strcmp((p -> argv)[0], "time") == 0 && (p -> argv)[1] != NULL){
+		(p -> argv)++;
+		j -> timed = 1;
+		if(p -> next == NULL && is_builtin((p -> argv)[0])){
+			status = run_builtin_stage(j, p, j -> stdin, j -> stdout);
+			print_job_times(j);
+			remove_job(j);
+		}else{
+			launch_job(j, foreground);
+			if(foreground && job_is_completed(j))
+				print_job_times(j);
+			status = last_status;
+		}
+		return (status == 0) ? 1 : -1;
+	}
+
+	if(p -> next != NULL || (p -> argv)[0] == NULL || !is_builtin((p -> argv)[0]))
+		return 0;	/* not a builtin command */
+
+	unsigned long long t;
+	TRACE_BEGIN(t);
+	status = run_builtin(p, j -> stdin, j -> stdout, j -> stderr);
+	TRACE_END(t, "builtin", (p -> argv)[0]);
+
+	remove_job(j);
+
+	return (status == 0) ? 1 : -1;	/* is a builtin command : return 1 if success, return -1 if failed */
 }
 
 
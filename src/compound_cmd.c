@@ -0,0 +1,755 @@
+/*
+ * compound_cmd.c
+ *
+ * Note:
+ *   The compound commands if, while, until, for and case span several lines, as the shell
+ *   has no ';'. When a line starts with one of them, the lines up to the matching fi, done
+ *   or esac are read and compiled once into a tree of cnodes, allocated from one arena.
+ *   A simple command in the tree keeps its compiled template, so running it again only
+ *   expands the template into a new job, like a hit of the command cache: a loop body is
+ *   not scanned again on each iteration.
+ *   The syntax is line based. then, do and else may be followed by the first command of
+ *   their list, and a case pattern by the first command of its branch. A branch ends at
+ *   a line that ends with ;; or at esac:
+ *       if <command>                 while <command>          for <name> in <word>...
+ *       then <command>               do <command>             do <command>
+ *       elif <command>               done                     done
+ *       then <command>
+ *       else <command>               case <word> in
+ *       fi                           <pattern>[|<pattern>]...) <command> ;;
+ *                                    esac
+ *   break and continue leave or restart the innermost loop. A compound command cannot be
+ *   redirected, put in a pipeline or run in the background as a whole; its commands can.
+ */
+/* $begin compound_cmd.c */
+#define _POSIX_C_SOURCE 200809L	/* for sigaction(), see FEATURE_TEST_MACROS(7) */
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <signal.h>
+#include <fnmatch.h>
+#include "myshell.h"
+#include "variablelib.h"
+#include "snapshotlib.h"
+#include "wrapper.h"
+
+
+/* Kinds of nodes. */
+#define CN_CMD			0
+#define CN_IF			1
+#define CN_WHILE		2
+#define CN_UNTIL		3
+#define CN_FOR			4
+#define CN_CASE			5
+#define CN_BREAK		6
+#define CN_CONTINUE		7
+
+/* The reserved words, in the order of keywords[]. */
+#define KW_NONE			-1
+#define KW_IF			0
+#define KW_THEN			1
+#define KW_ELIF			2
+#define KW_ELSE			3
+#define KW_FI			4
+#define KW_WHILE		5
+#define KW_UNTIL		6
+#define KW_DO			7
+#define KW_DONE			8
+#define KW_FOR			9
+#define KW_CASE			10
+#define KW_ESAC			11
+#define KW_BREAK		12
+#define KW_CONTINUE		13
+#define KW_DSEMI		14		/* a line of a case branch that ends with ;; */
+#define KW_EOF			15
+
+static const char *keywords[] = {"if", "then", "elif", "else", "fi", "while", "until",
+                                 "do", "done", "for", "case", "esac", "break", "continue"};
+#define NKEYWORDS		(sizeof(keywords) / sizeof(keywords[0]))
+
+/* A branch of a case command. */
+typedef struct cbranch
+{
+	struct cbranch *next;
+	cmd_template **patterns;
+	size_t npatterns;
+	struct cnode *body;
+} cbranch;
+
+typedef struct cnode
+{
+	int kind;
+	struct cnode *next;			/* next command of the list */
+	const char *text;			/* CN_CMD: the command text; CN_FOR: the name of the variable */
+	size_t len;					/* length of text */
+	cmd_template *tmpl;			/* CN_CMD: the command; CN_FOR: the words; CN_CASE: the word */
+	struct cnode *cond;			/* CN_IF, CN_WHILE, CN_UNTIL: the condition */
+	struct cnode *body;			/* then or do */
+	struct cnode *orelse;		/* CN_IF: else, or the elif as a CN_IF */
+	cbranch *branches;			/* CN_CASE */
+} cnode;
+
+/* The state of the parser. */
+static arena *cmem;				/* holds the tree */
+static char *cont_prompt;		/* prompt of the lines after the first one */
+static int syntax_error;		/* the command is not run */
+static int abandoned;			/* a reserved word is missing, so parsing stops */
+
+/* The state of the execution. */
+#define LOOP_BREAK		1
+#define LOOP_CONTINUE	2
+
+static int loop_depth;
+static int loop_ctl;			/* LOOP_BREAK or LOOP_CONTINUE, 0 otherwise */
+static volatile sig_atomic_t interrupted;
+
+
+/* Return the reserved word that the line line starts with, or KW_NONE, and point *rest
+ * to the text after it. The line has no leading or repeated blanks (scan_cmd()).
+ */
+static
+int
+keyword (const char * line, const char ** rest)
+{
+	size_t i, n = strcspn(line, " \t");
+
+	for(i = 0; i < NKEYWORDS; i++){
+		if(strlen(keywords[i]) == n && strncmp(line, keywords[i], n) == 0){
+			*rest = line + n + strspn(line + n, " \t");
+			return i;
+		}
+	}
+	*rest = line;
+	return KW_NONE;
+}
+
+
+static
+void
+parse_error (const char * msg, const char * word)
+{
+	if(!syntax_error)
+		fprintf(stderr, "myshell: syntax error: %s%s%s\n", msg, word ? " " : "", word ? word : "");
+	syntax_error = 1;
+}
+
+
+/* A syntax error that leaves the parser unsure where the command ends. */
+static
+void
+parse_abandon (const char * msg, const char * word)
+{
+	parse_error(msg, word);
+	abandoned = 1;
+}
+
+
+/* Read the next line that is not empty and return a copy of its text, or NULL at the end
+ * of the input.
+ */
+static
+const char *
+next_line (void)
+{
+	char *cmdline, *text;
+	size_t len;
+
+	while((cmdline = next_cmd(cont_prompt)) != NULL){
+		if(cmd_is_empty(cmdline))
+			continue;
+		if((text = scan_cmd(cmdline, &len)) == NULL){
+			syntax_error = abandoned = 1;	/* the history expansion failed */
+			return NULL;
+		}
+		return arena_strdup(cmem, text, len);
+	}
+	return NULL;
+}
+
+
+static
+cnode *
+new_node (int kind)
+{
+	cnode *n = arena_alloc(cmem, sizeof(cnode));
+
+	memset(n, 0, sizeof(cnode));
+	n -> kind = kind;
+	return n;
+}
+
+
+static cnode * parse_compound (int kw, const char * rest);
+
+
+/* Parse a list of commands that starts with the text first (if not empty) and goes on
+ * until a line starts with a reserved word that ends a list. Return the list, the word
+ * in *end and the text after it in *rest. In a case branch (in_case), a line that ends
+ * with ;; ends the list too.
+ */
+static
+cnode *
+parse_list (const char * first, int in_case, int * end, const char ** rest)
+{
+	cnode *head = NULL, **tail = &head;
+	const char *line = first;
+
+	for(;;){
+		if(line == NULL || *line == '\0'){
+			if((line = next_line()) == NULL){
+				*end = KW_EOF;
+				*rest = "";
+				return head;
+			}
+		}
+
+		/* ;; ends a case branch, after the command in front of it */
+		char *text = (char *) line;
+		int dsemi = 0;
+		size_t n = strlen(text);
+		if(in_case && n >= 2 && strcmp(text + n - 2, ";;") == 0){
+			text = arena_strdup(cmem, text, n - 2);
+			while(n > 2 && (text[n - 3] == ' ' || text[n - 3] == '\t'))
+				text[--n - 2] = '\0';
+			dsemi = 1;
+		}
+
+		const char *after;
+		int kw = keyword(text, &after);
+		cnode *node = NULL;
+
+		switch (kw) {
+			case KW_THEN: case KW_ELIF: case KW_ELSE: case KW_FI:
+			case KW_DO: case KW_DONE: case KW_ESAC:
+				*end = kw;
+				*rest = after;
+				return head;
+			case KW_IF: case KW_WHILE: case KW_UNTIL: case KW_FOR: case KW_CASE:
+				node = parse_compound(kw, after);
+				break;
+			case KW_BREAK: case KW_CONTINUE:
+				if(*after != '\0')
+					parse_error("unexpected", after);
+				node = new_node((kw == KW_BREAK) ? CN_BREAK : CN_CONTINUE);
+				break;
+			default:
+				if(*text == '\0')
+					break;
+				node = new_node(CN_CMD);
+				node -> text = text;
+				node -> len = strlen(text);
+				if((node -> tmpl = compile_text(text, cmem)) == NULL)
+					syntax_error = 1;
+				break;
+		}
+		if(abandoned)
+			return NULL;
+
+		if(node != NULL){
+			*tail = node;
+			tail = &(node -> next);
+		}
+		if(dsemi){
+			*end = KW_DSEMI;
+			*rest = "";
+			return head;
+		}
+		line = NULL;
+	}
+}
+
+
+/* Parse a list that must end with the reserved word want. Return the text after it. */
+static
+cnode *
+parse_until (const char * first, int want, const char ** rest)
+{
+	int end;
+	cnode *list = parse_list(first, 0, &end, rest);
+
+	if(abandoned)
+		return NULL;
+	if(end != want){
+		parse_abandon((end == KW_EOF) ? "unexpected end of file, expected" : "expected", keywords[want]);
+		return NULL;
+	}
+	return list;
+}
+
+
+/* Nothing may follow fi, done or esac on its line. */
+static
+void
+check_end (const char * rest, int kw)
+{
+	if(*rest != '\0')
+		parse_error("unexpected text after", keywords[kw]);
+}
+
+
+static
+cnode *
+parse_if (const char * first)
+{
+	cnode *node = new_node(CN_IF);
+	const char *rest;
+	int end;
+
+	node -> cond = parse_until(first, KW_THEN, &rest);
+	if(abandoned)
+		return NULL;
+	if(node -> cond == NULL)
+		parse_error("missing condition before", "then");
+	node -> body = parse_list(rest, 0, &end, &rest);
+	if(abandoned)
+		return NULL;
+
+	switch (end) {
+		case KW_ELIF:
+			node -> orelse = parse_if(rest);	/* goes on to the fi */
+			break;
+		case KW_ELSE:
+			node -> orelse = parse_until(rest, KW_FI, &rest);
+			check_end(rest, KW_FI);
+			break;
+		case KW_FI:
+			check_end(rest, KW_FI);
+			break;
+		default:
+			parse_abandon((end == KW_EOF) ? "unexpected end of file, expected" : "expected", "fi");
+	}
+	return abandoned ? NULL : node;
+}
+
+
+/* Parse "do <list> done" after the head of a loop. */
+static
+cnode *
+parse_do (const char * first)
+{
+	const char *rest;
+	cnode *body;
+
+	body = parse_until(first, KW_DO, &rest);
+	if(abandoned)
+		return NULL;
+	if(body != NULL)
+		parse_error("expected", "do");
+	body = parse_until(rest, KW_DONE, &rest);
+	check_end(rest, KW_DONE);
+	return body;
+}
+
+
+/* Return true if s is a valid variable name. */
+static
+int
+is_name (const char * s, size_t n)
+{
+	size_t i;
+
+	if(n == 0 || (s[0] >= '0' && s[0] <= '9'))
+		return 0;
+	for(i = 0; i < n; i++)
+		if(!(s[i] == '_' || (s[i] >= 'a' && s[i] <= 'z') || (s[i] >= 'A' && s[i] <= 'Z')
+		     || (s[i] >= '0' && s[i] <= '9')))
+			return 0;
+	return 1;
+}
+
+
+/* for <name> in <word>... */
+static
+cnode *
+parse_for (const char * first)
+{
+	cnode *node = new_node(CN_FOR);
+	size_t n = strcspn(first, " \t");
+	const char *words = first + n + strspn(first + n, " \t");
+
+	node -> text = arena_strdup(cmem, first, n);
+	if(!is_name(first, n))
+		parse_error("invalid name in for:", first);
+	else if(strncmp(words, "in", 2) != 0 || (words[2] != '\0' && words[2] != ' ' && words[2] != '\t'))
+		parse_error("expected in after for", node -> text);
+	else if(*(words += 2 + strspn(words + 2, " \t")) != '\0'
+	        && (node -> tmpl = compile_text(words, cmem)) == NULL)
+		syntax_error = 1;
+
+	/* the body is read even after an error, so that it is not taken for more commands */
+	node -> body = parse_do(NULL);
+	return abandoned ? NULL : node;
+}
+
+
+/* case <word> in, followed by the branches up to esac */
+static
+cnode *
+parse_case (const char * first)
+{
+	cnode *node = new_node(CN_CASE);
+	cbranch **tail = &(node -> branches);
+	size_t n = strlen(first);
+	const char *line, *rest;
+	int end;
+
+	if(n < 3 || strcmp(first + n - 3, " in") != 0)
+		parse_error("expected in after case", first);
+	else if((node -> tmpl = compile_text(arena_strdup(cmem, first, n - 3), cmem)) == NULL)
+		syntax_error = 1;
+
+	for(;;){
+		if((line = next_line()) == NULL){
+			parse_abandon("unexpected end of file, expected", "esac");
+			return NULL;
+		}
+		if(keyword(line, &rest) == KW_ESAC){
+			check_end(rest, KW_ESAC);
+			return abandoned ? NULL : node;
+		}
+
+		/* [(]<pattern>[|<pattern>]...) */
+		const char *close = strchr(line, ')');
+		if(close == NULL){
+			parse_error("expected ) after the pattern", line);
+			continue;
+		}
+		if(*line == '(')
+			line++;
+
+		cbranch *b = arena_alloc(cmem, sizeof(cbranch));
+		const char *p;
+		b -> next = NULL;
+		b -> npatterns = 1;
+		for(p = line; p < close; p++)
+			if(*p == '|')
+				b -> npatterns++;
+		b -> patterns = arena_alloc(cmem, sizeof(cmd_template *) * b -> npatterns);
+		for(n = 0, p = line; n < b -> npatterns; n++){
+			size_t len = strcspn(p, "|)");
+			char *pat = arena_strdup(cmem, p, len);
+			while(len > 0 && (pat[len - 1] == ' ' || pat[len - 1] == '\t'))
+				pat[--len] = '\0';
+			pat += strspn(pat, " \t");
+			if(*pat == '\0')
+				parse_error("empty pattern in case", NULL);
+			else if(((b -> patterns)[n] = compile_text(pat, cmem)) == NULL)
+				syntax_error = 1;
+			p += strcspn(p, "|)") + 1;
+		}
+
+		b -> body = parse_list(close + 1 + strspn(close + 1, " \t"), 1, &end, &rest);
+		if(abandoned)
+			return NULL;
+		*tail = b;
+		tail = &(b -> next);
+		if(end == KW_ESAC){
+			check_end(rest, KW_ESAC);
+			return abandoned ? NULL : node;
+		}
+		if(end != KW_DSEMI){
+			parse_abandon((end == KW_EOF) ? "unexpected end of file, expected" : "expected", "esac");
+			return NULL;
+		}
+	}
+}
+
+
+static
+cnode *
+parse_compound (int kw, const char * rest)
+{
+	cnode *node;
+
+	switch (kw) {
+		case KW_IF:
+			return parse_if(rest);
+		case KW_WHILE:
+		case KW_UNTIL:
+			node = new_node((kw == KW_WHILE) ? CN_WHILE : CN_UNTIL);
+			node -> cond = parse_until(rest, KW_DO, &rest);
+			if(abandoned)
+				return NULL;
+			if(node -> cond == NULL)
+				parse_error("missing condition before", "do");
+			node -> body = parse_until(rest, KW_DONE, &rest);
+			check_end(rest, KW_DONE);
+			return abandoned ? NULL : node;
+		case KW_FOR:
+			return parse_for(rest);
+		default:
+			return parse_case(rest);
+	}
+}
+
+
+/*************
+ * Execution
+ ************/
+static void run_list (cnode * n);
+
+
+static
+void
+run_simple (cnode * n)
+{
+	int rv = instantiate_cmd(n -> tmpl, n -> text, n -> len);
+
+	if(rv == -1){
+		last_status = 1;
+		return;
+	}
+	if(rv == 0)
+		return;
+	if(builtin_cmd(current_job) == 0){
+		launch_job(current_job, foreground);
+		do_job_notification();	/* deletes the job if it is done */
+	}
+	if(last_status == 128 + SIGINT)
+		interrupted = 1;		/* the user wants the whole command to stop */
+}
+
+
+/* Expand the template t into one word (the words joined by blanks), allocated from mem. */
+static
+char *
+expand_word (const cmd_template * t, arena * mem)
+{
+	char **argv = expand_args(t, mem), **arg;
+	size_t len = 0;
+
+	if(argv == NULL)
+		return NULL;
+	for(arg = argv; *arg != NULL; arg++)
+		len += strlen(*arg) + 1;
+
+	char *word = arena_alloc(mem, len + 1);
+	word[0] = '\0';
+	for(arg = argv; *arg != NULL; arg++){
+		if(arg != argv)
+			strcat(word, " ");
+		strcat(word, *arg);
+	}
+	return word;
+}
+
+
+/* Run the body of a loop. Return true if the loop must end. */
+static
+int
+run_body (cnode * body)
+{
+	run_list(body);
+	if(loop_ctl == LOOP_BREAK){
+		loop_ctl = 0;
+		return 1;
+	}
+	loop_ctl = 0;
+	return interrupted;
+}
+
+
+static
+void
+run_node (cnode * n)
+{
+	int status = 0;
+
+	switch (n -> kind) {
+		case CN_CMD:
+			run_simple(n);
+			break;
+
+		case CN_IF:
+			run_list(n -> cond);
+			if(interrupted || loop_ctl)
+				break;
+			if(last_status == 0)
+				run_list(n -> body);
+			else if(n -> orelse != NULL)
+				run_list(n -> orelse);
+			else
+				last_status = 0;
+			break;
+
+		case CN_WHILE:
+		case CN_UNTIL:
+			loop_depth++;
+			for(;;){
+				run_list(n -> cond);
+				if(interrupted || loop_ctl)
+					break;
+				if((last_status == 0) != (n -> kind == CN_WHILE))
+					break;
+				if(run_body(n -> body))
+					break;
+				status = last_status;
+			}
+			loop_ctl = 0;
+			loop_depth--;
+			last_status = status;
+			break;
+
+		case CN_FOR: {
+			arena mem;
+			char **words, **w;
+			static char *no_words[] = {NULL};
+
+			arena_init(&mem);
+			words = (n -> tmpl != NULL) ? expand_args(n -> tmpl, &mem) : no_words;
+			if(words == NULL){
+				arena_free(&mem);
+				last_status = 1;
+				break;
+			}
+			loop_depth++;
+			for(w = words; *w != NULL; w++){
+				set_variable((char *) n -> text, *w);
+				if(run_body(n -> body))
+					break;
+				status = last_status;
+			}
+			loop_depth--;
+			arena_free(&mem);
+			last_status = status;
+			break;
+		}
+
+		case CN_CASE: {
+			arena mem;
+			cbranch *b;
+			size_t i;
+			char *word, *pat;
+
+			arena_init(&mem);
+			if((word = expand_word(n -> tmpl, &mem)) == NULL){
+				arena_free(&mem);
+				last_status = 1;
+				break;
+			}
+			last_status = 0;
+			for(b = n -> branches; b != NULL; b = b -> next){
+				for(i = 0; i < b -> npatterns; i++)
+					if((pat = expand_word((b -> patterns)[i], &mem)) != NULL
+					   && fnmatch(pat, word, 0) == 0)
+						break;
+				if(i < b -> npatterns){
+					run_list(b -> body);
+					break;
+				}
+			}
+			arena_free(&mem);
+			break;
+		}
+
+		case CN_BREAK:
+		case CN_CONTINUE:
+			if(loop_depth == 0){
+				fprintf(stderr, "%s: only meaningful in a loop\n",
+				        (n -> kind == CN_BREAK) ? "break" : "continue");
+				last_status = 1;
+				break;
+			}
+			loop_ctl = (n -> kind == CN_BREAK) ? LOOP_BREAK : LOOP_CONTINUE;
+			last_status = 0;
+			break;
+	}
+}
+
+
+static
+void
+run_list (cnode * n)
+{
+	for(; n != NULL && !loop_ctl && !interrupted; n = n -> next)
+		run_node(n);
+}
+
+
+static
+void
+compound_sigint (int sig)
+{
+	interrupted = 1;
+}
+
+
+/* Return true if the line line (as read, not scanned) starts with a reserved word,
+ * so that it must be run by run_compound().
+ */
+int
+is_compound (const char * line)
+{
+	const char *rest;
+
+	line += strspn(line, " \t");
+	return keyword(line, &rest) != KW_NONE;
+}
+
+
+/* Read the rest of the compound command that starts with the line line, reading more
+ * lines with the prompt prompt, and run it. Return -1 if it has a syntax error.
+ */
+int
+run_compound (char * line, char * prompt)
+{
+	arena mem;
+	const char *text, *rest;
+	size_t len;
+	cnode *tree = NULL;
+	int kw;
+
+	if((text = scan_cmd(line, &len)) == NULL)
+		return -1;
+
+	arena_init(&mem);
+	cmem = &mem;
+	cont_prompt = prompt;
+	syntax_error = abandoned = 0;
+	text = arena_strdup(cmem, text, len);
+
+	/* the rest of the lines of a compound command cannot be replayed from a snapshot */
+	if(snapshot_recording)
+		snapshot_invalidate();
+
+	kw = keyword(text, &rest);
+	switch (kw) {
+		case KW_IF: case KW_WHILE: case KW_UNTIL: case KW_FOR: case KW_CASE:
+			tree = parse_compound(kw, rest);
+			break;
+		case KW_BREAK: case KW_CONTINUE:
+			tree = new_node((kw == KW_BREAK) ? CN_BREAK : CN_CONTINUE);
+			break;
+		default:
+			parse_error("unexpected", keywords[kw]);
+	}
+
+	if(syntax_error){
+		arena_free(&mem);
+		last_status = 2;
+		return -1;
+	}
+
+	struct sigaction sa, old_sa;
+	interrupted = 0;
+	loop_ctl = 0;
+	loop_depth = 0;
+	if(shell_is_interactive){
+		/* Ctrl-C stops a loop of builtins, which run in the shell */
+		memset(&sa, 0, sizeof(sa));
+		sa.sa_handler = compound_sigint;
+		sigemptyset(&sa.sa_mask);
+		sigaction(SIGINT, &sa, &old_sa);
+	}
+
+	run_node(tree);
+
+	if(shell_is_interactive)
+		sigaction(SIGINT, &old_sa, NULL);
+	arena_free(&mem);
+	return 0;
+}
+
+
+/* $end compound_cmd.c */
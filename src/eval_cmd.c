@@ -1,508 +1,1069 @@
-/* 
+/*
  * eval_cmd.c
+ *
+ * Note:
+ *   A command line goes through three steps:
+ *     1. One pass squeezes the blanks and expands history references. The result is the
+ *        text that goes into the history list and the job entry.
+ *     2. The text is looked up in a bounded LRU cache of compiled commands. On a miss it
+ *        is compiled once into a template: the processes, their words and redirections,
+ *        where each word is a list of literal, variable and tilde segments.
+ *     3. The template is instantiated into the job: only the variable and tilde segments
+ *        are expanded, and a command name that is an alias is replaced by its words. The
+ *        job, its command text, its processes and their arguments are all allocated from
+ *        the arena of the job, so free_job() is a single arena_free().
  */
 /* $begin eval_cmd.c */
 #include <stdio.h>
 #include <stdlib.h>
 #include <string.h>
-#include <ctype.h>
-#include <assert.h>
+#include <limits.h>
 #include <unistd.h>
 #include <sys/types.h>
 #include <pwd.h>
 #include "myshell.h"
 #include "historylib.h"
 #include "variablelib.h"
+#include "aliaslib.h"
+#include "tracelib.h"
+#include "snapshotlib.h"
 #include "wrapper.h"
 
 
+#define CMDCACHE_SIZE       128     /* maximum number of cached commands */
+#define CMDCACHE_BUCKETS    256
+
+/* Character classes used by the scanners. */
+#define CC_BLANK    0x01    /* ' ' and '\t' */
+#define CC_DIGIT    0x02    /* '0' - '9' */
+#define CC_NAME     0x04    /* characters of a variable name: [A-Za-z0-9_] */
+#define CC_META     0x08    /* '|', '<' and '>' end a word */
+#define CC_SPECIAL  0x10    /* '!', '~', '$' and '&' may start an expansion */
+#define CC_END      0x20    /* '\0' */
+
+#define CC_STOP     (CC_BLANK | CC_META | CC_SPECIAL | CC_END)
+
+static unsigned char cc_table[256];
+
 static
-char *
-delete_extra_blank (char * cmdline)
+void
+init_cc_table (void)
 {
-    char *new_cmdline = emalloc(strlen(cmdline) + 1);
+    int c;
 
-    char c;
-    int cmd_pos_start = 0;
-    int cmd_pos_end = 0;
-    int new_cmd_pos = 0;
-    while((c = cmdline[cmd_pos_start])){
-        if(!isblank(c)){
-            cmd_pos_end = cmd_pos_start + 1;
-            char tmp_c;
-            while((tmp_c = cmdline[cmd_pos_end]) != '\0' && !isblank(tmp_c))
-                cmd_pos_end++;
-            int substr_len = cmd_pos_end - cmd_pos_start;
-            strncpy(&new_cmdline[new_cmd_pos], &cmdline[cmd_pos_start], substr_len);
-            new_cmd_pos += substr_len;
-            new_cmdline[new_cmd_pos++] = ' ';
-            cmd_pos_start = cmd_pos_end;
-        }else
-            cmd_pos_start++;
+    cc_table['\0'] = CC_END;
+    cc_table[' '] = cc_table['\t'] = CC_BLANK;
+    for(c = '0'; c <= '9'; c++)
+        cc_table[c] = CC_DIGIT | CC_NAME;
+    for(c = 'a'; c <= 'z'; c++)
+        cc_table[c] = CC_NAME;
+    for(c = 'A'; c <= 'Z'; c++)
+        cc_table[c] = CC_NAME;
+    cc_table['_'] = CC_NAME;
+    cc_table['|'] = cc_table['<'] = cc_table['>'] = CC_META;
+    cc_table['!'] = cc_table['~'] = cc_table['$'] = cc_table['&'] = CC_SPECIAL;
+}
+
+
+/* A growable byte buffer. */
+typedef struct strbuf
+{
+    char *s;
+    size_t len;
+    size_t size;
+} strbuf;
+
+static
+void
+sb_reserve (strbuf * sb, size_t n)
+{
+    if(sb -> len + n > sb -> size){
+        size_t size = sb -> size ? sb -> size : BUF_SIZE;
+        while(sb -> len + n > size)
+            size *= 2;
+        sb -> s = erealloc(sb -> s, size);
+        sb -> size = size;
     }
-    new_cmdline[new_cmd_pos-1] = '\0';
+}
+
+static
+void
+sb_put (strbuf * sb, const char * p, size_t n)
+{
+    sb_reserve(sb, n);
+    memcpy(&(sb -> s)[sb -> len], p, n);
+    sb -> len += n;
+}
 
-    free(cmdline);
-    return new_cmdline;
+static
+void
+sb_putc (strbuf * sb, char c)
+{
+    sb_reserve(sb, 1);
+    (sb -> s)[(sb -> len)++] = c;
 }
 
 
+/* Grow the array *pa of *psize elements of size n to hold at least count + 1 elements. */
 static
-char *
-history_expand (char * cmdline)
+void
+grow_array (void ** pa, size_t * psize, size_t count, size_t n)
 {
-    char *new_cmdline;
-    size_t len = strlen(cmdline) + 1;
-    size_t bufspace = ((len + BUF_SIZE - 1) / BUF_SIZE) * BUF_SIZE;
-    new_cmdline = emalloc(bufspace);
+    if(count >= *psize){
+        *psize = *psize ? *psize * 2 : ARGV_SIZ;
+        *pa = erealloc(*pa, n * *psize);
+    }
+}
 
-    char c;
-    int cmd_pos_start = 0;
-    int cmd_pos_end = 0;
-    int new_cmd_pos = 0;
-    int flag = 0;
-    /* Start history expand. */
-    /* If failed: 1.print error message; 2.free cmdline and new_cmdline; 3.return -1. */
-    while((c = cmdline[cmd_pos_start])){
-        if(c == '!' && isdigit(cmdline[cmd_pos_start+1])){
-            cmd_pos_end = cmd_pos_start + 1;
-            while(isdigit(cmdline[cmd_pos_end]))
-                cmd_pos_end++;
-            int hist_index = atoi(&cmdline[cmd_pos_start+1]);
-            char *rv;
-            if((rv = get_hist(hist_index)) == (char *) -1){ /* failed */
-                fprintf(stderr, "Error: history expand failed\n");
-                free(cmdline); free(new_cmdline);
-                return (char *) -1;
-            }else{
-                size_t substr_len = strlen(rv);
-                if(new_cmd_pos + substr_len + 1 >= bufspace){
-                    size_t inc_bufspace = ((substr_len + BUF_SIZE - 1) / BUF_SIZE) * BUF_SIZE;
-                    new_cmdline = erealloc(new_cmdline, bufspace + inc_bufspace);
-                    bufspace += inc_bufspace;
-                }
-                strcpy(&new_cmdline[new_cmd_pos], rv);
-                new_cmd_pos += substr_len;
-                cmd_pos_start = cmd_pos_end;
-                flag = 1;
-            }
-        }else{
-            if(new_cmd_pos + 1 >= bufspace) {
-                new_cmdline = erealloc(new_cmdline, bufspace + BUF_SIZE);
-                bufspace += BUF_SIZE;
-            }
-            new_cmdline[new_cmd_pos++] = c;
-            cmd_pos_start++;
+
+/*******************
+ * Compiled commands
+ ******************/
+/* $begin template */
+#define SEG_LITERAL     0
+#define SEG_VARIABLE    1
+#define SEG_TILDE       2
+
+/* A piece of a word. A literal is the len bytes at s. A variable is the variable named
+ * name. A tilde prefix is expanded to the home directory of name (the login name if name
+ * is empty), or is kept as the len bytes at s if the user does not exist.
+ */
+typedef struct segment
+{
+    int kind;
+    const char *s;
+    size_t len;
+    char *name;
+} segment;
+
+/* A word is the segments [first_seg, first_seg + nsegs). fd is -1 for an argument,
+ * otherwise the word is the file name of a redirection of fd.
+ */
+typedef struct tword
+{
+    size_t first_seg, nsegs;
+    int fd;
+    int is_append;
+} tword;
+
+typedef struct tstage
+{
+    size_t first_word, nwords;
+} tstage;
+
+typedef struct cmd_template
+{
+    segment *segs;
+    tword *words;
+    tstage *stages;
+    size_t nsegs, nwords, nstages;
+    int background;
+} cmd_template;
+
+/* The compiler builds a template in these scratch arrays. */
+static cmd_template ct;
+static size_t ct_segs_size, ct_words_size, ct_stages_size;
+static size_t ct_word_start, ct_stage_start;
+static int ct_re_fd, ct_re_append;
+
+
+static
+void
+add_segment (int kind, const char * s, size_t len, char * name)
+{
+    if(kind == SEG_LITERAL && ct.nsegs > ct_word_start){
+        segment *last = &ct.segs[ct.nsegs - 1];
+        if(last -> kind == SEG_LITERAL && last -> s + last -> len == s){
+            last -> len += len;
+            return;
         }
     }
-    new_cmdline[new_cmd_pos] = '\0';
-    /* End history expand. */
-    
-    /* If success. */
-    if(flag)
-        printf("%s\n", new_cmdline);
-    free(cmdline);
-    return new_cmdline;
+
+    grow_array((void **) &ct.segs, &ct_segs_size, ct.nsegs, sizeof(segment));
+    segment *seg = &ct.segs[ct.nsegs++];
+    seg -> kind = kind;
+    seg -> s = s;
+    seg -> len = len;
+    seg -> name = name;
 }
 
 
 static
 void
-add_job (char * command)
+end_tword (void)
 {
-    job *new_job = emalloc(sizeof(job));
+    if(ct.nsegs == ct_word_start)
+        return;
 
-    new_job -> next = NULL;
-    new_job -> command = command;
-    new_job -> first_process = NULL;
-    new_job -> jid = job_id++;
-    new_job -> pgid = 0;
-    new_job -> notified = 0;
-    new_job -> tmodes = shell_tmodes;
-    new_job -> stdin = STDIN_FILENO;
-    new_job -> stdout = STDOUT_FILENO;
-    new_job -> stderr = STDERR_FILENO;
+    grow_array((void **) &ct.words, &ct_words_size, ct.nwords, sizeof(tword));
+    tword *w = &ct.words[ct.nwords++];
+    w -> first_seg = ct_word_start;
+    w -> nsegs = ct.nsegs - ct_word_start;
+    w -> fd = ct_re_fd;
+    w -> is_append = ct_re_append;
+    ct_word_start = ct.nsegs;
+    ct_re_fd = -1;
+}
 
-    if(first_job == NULL){
-        first_job = new_job;
-    }else{
-        job *j = first_job;
-        while(j -> next != NULL)
-            j = j -> next;
-        j -> next = new_job;
+
+/* The pipe uses an error when the left or right side of the pipe is empty, but the
+ * shell ignores these error cases. Empty means no words, such as:
+ * '|' or '| ls' or 'ls |' or 'ls || sort'  or 'ls |   | sort'.
+ */
+static
+int
+end_tstage (void)
+{
+    end_tword();
+    if(ct_re_fd != -1){
+        fprintf(stderr, "Error: missing file name for redirection\n");
+        return -1;
     }
-    current_job = new_job;
+    if(ct.nwords == ct_stage_start)
+        return 0;
+
+    grow_array((void **) &ct.stages, &ct_stages_size, ct.nstages, sizeof(tstage));
+    tstage *st = &ct.stages[ct.nstages++];
+    st -> first_word = ct_stage_start;
+    st -> nwords = ct.nwords - ct_stage_start;
+    ct_stage_start = ct.nwords;
+    return 0;
 }
 
 
+/* Compile the variable reference at s ('$' form or '${}' form).
+ * Return a pointer past the reference, or NULL if s is an ordinary '$'.
+ */
 static
-char *
-tilde_expand (char * cmdline)
+const char *
+compile_variable (const char * s, arena * mem)
 {
-    char *new_cmdline;
-    size_t len = strlen(cmdline) + 1;
-    size_t bufspace = ((len + BUF_SIZE - 1) / BUF_SIZE) * BUF_SIZE;
-    new_cmdline = emalloc(bufspace);
+    const char *name = s + 1;
+    const char *end;
+    const char *next;
 
-    char c;
-    int cmd_pos_start = 0;
-    int cmd_pos_end = 0;
-    int new_cmd_pos = 0;
-    /* Start tilde expand. */
-    while((c = cmdline[cmd_pos_start])){
-        if(c == '~' && (cmd_pos_start == 0 || isblank(cmdline[cmd_pos_start-1]))){
-            cmd_pos_end = cmd_pos_start + 1;
-            char tmp_c;
-            while((tmp_c = cmdline[cmd_pos_end]) != '\0' && !isblank(tmp_c) && tmp_c != '/')
-                cmd_pos_end++;
-
-            size_t username_len = cmd_pos_end - cmd_pos_start - 1;
-            char *username;
-            if(username_len != 0){
-                username = emalloc(username_len + 1);
-                strncpy(username, &cmdline[cmd_pos_start+1], username_len);
-                username[username_len] = '\0';
-            }else
-                username = getlogin();  /* If return NULL ? */
-
-            struct passwd *rv;
-            if((rv = getpwnam(username)) == NULL){
-                if(username_len != 0)
-                    free(username);
-                goto tilde_expand_failed;
-            }else{
-                size_t substr_len = strlen(rv -> pw_dir);
-                if(new_cmd_pos + substr_len + 1 >= bufspace){
-                    size_t inc_bufspace = ((substr_len + BUF_SIZE - 1) / BUF_SIZE) * BUF_SIZE;
-                    new_cmdline = erealloc(new_cmdline, bufspace + inc_bufspace);
-                    bufspace += inc_bufspace;
-                }
-                strncpy(&new_cmdline[new_cmd_pos], rv -> pw_dir, substr_len);
-                new_cmd_pos += substr_len;
-                cmd_pos_start = cmd_pos_end;
-                if(username_len != 0)
-                    free(username);
-            }
-        }else{
-            tilde_expand_failed:
-            if(new_cmd_pos + 1 >= bufspace){
-                new_cmdline = erealloc(new_cmdline, bufspace + BUF_SIZE);
-                bufspace += BUF_SIZE;
-            }
-            new_cmdline[new_cmd_pos++] = c;
-            cmd_pos_start++;
-        }
+    if(*name == '{'){   /* Form 1 : ${var_name} */
+        name++;
+        end = name;
+        while(!(cc_table[(unsigned char) *end] & (CC_BLANK | CC_END)) && *end != '}')
+            end++;
+        if(*end != '}' || end == name)
+            return NULL;
+        next = end + 1;
+    }else{  /* Form 2 : $var_name, or $? */
+        end = name;
+        if(*end == '?')
+            end++;
+        else
+            while(cc_table[(unsigned char) *end] & CC_NAME)
+                end++;
+        if(end == name)
+            return NULL;
+        next = end;
     }
-    new_cmdline[new_cmd_pos] = '\0';
-    /* End tilde expand. */
-    
-    free(cmdline);
-    return new_cmdline;
+
+    add_segment(SEG_VARIABLE, s, next - s, arena_strdup(mem, name, end - name));
+    return next;
 }
 
 
+/* Compile the tilde prefix at s. Return a pointer past the prefix. */
 static
-char *
-variable_expand (char * cmdline)
+const char *
+compile_tilde (const char * s, arena * mem)
+{
+    const char *end = s + 1;
+    while(!(cc_table[(unsigned char) *end] & (CC_BLANK | CC_META | CC_END)) && *end != '/')
+        end++;
+
+    add_segment(SEG_TILDE, s, end - s, arena_strdup(mem, s + 1, end - s - 1));
+    return end;
+}
+
+
+/* Return true if only blanks are left in s. */
+static
+int
+rest_is_blank (const char * s)
 {
-    char *new_cmdline;
-    size_t len = strlen(cmdline) + 1;
-    size_t bufspace = ((len + BUF_SIZE - 1) / BUF_SIZE) * BUF_SIZE;
-    new_cmdline = emalloc(bufspace);
+    while(cc_table[(unsigned char) *s] & CC_BLANK)
+        s++;
+    return *s == '\0';
+}
+
 
+/* Compile the command text s into the template ct. The segments point into s,
+ * and variable and user names are allocated from mem.
+ * Return 0 if success, -1 if failed.
+ */
+static
+int
+compile_cmd (const char * s, arena * mem)
+{
+    int boundary = 1;   /* true if s starts a new word */
     char c;
-    int cmd_pos_start = 0;
-    int cmd_pos_end = 0;
-    int new_cmd_pos = 0;
-    /* Start variable expand. */
-    while((c = cmdline[cmd_pos_start])){
-        char next_c;
-        if(c == '$' && (next_c = cmdline[cmd_pos_start+1]) != '\0' && !isblank(next_c)){
-            if(next_c == '{'){  /* Form 1 : ${var_name} */
-                cmd_pos_end = cmd_pos_start + 2;
-                char tmp_c;
-                while((tmp_c = cmdline[cmd_pos_end]) != '\0' && !isblank(tmp_c) && tmp_c != '}')
-                    cmd_pos_end++;
-                if(tmp_c == '\0' || isblank(tmp_c))
-                    goto ordinary_character;
-                cmd_pos_end++;
-
-                size_t var_name_len = cmd_pos_end - cmd_pos_start - 3;
-                if(var_name_len == 0)
-                    goto ordinary_character;
-
-                char *var_name = emalloc(var_name_len + 1);
-                strncpy(var_name, &cmdline[cmd_pos_start+2], var_name_len);
-                var_name[var_name_len] = '\0';
-
-                /*** 1 : The same code (begin) ***/
-                char *rv;
-                if((rv = get_value_by_name(var_name)) != NULL){
-                    size_t substr_len = strlen(rv);
-                    if(new_cmd_pos + substr_len + 1 >= bufspace){
-                        size_t inc_bufspace = ((substr_len + BUF_SIZE - 1) / BUF_SIZE) * BUF_SIZE;
-                        new_cmdline = erealloc(new_cmdline, bufspace + inc_bufspace);
-                        bufspace += inc_bufspace;
-                    }
-                    strcpy(&new_cmdline[new_cmd_pos], rv);
-                    new_cmd_pos += substr_len;
-                }
-                cmd_pos_start = cmd_pos_end;
-                free(var_name);
-                /*** 1 : The same code (end) ***/
-            }else{  /* Form 2 : $var_name */
-                cmd_pos_end = cmd_pos_start + 2;
-                char tmp_c;
-                while((tmp_c = cmdline[cmd_pos_end]) != '\0' && !isblank(tmp_c))
-                    cmd_pos_end++;
-
-                size_t var_name_len = cmd_pos_end - cmd_pos_start - 1;
-                char *var_name = emalloc(var_name_len + 1);
-                strncpy(var_name, &cmdline[cmd_pos_start+1], var_name_len);
-                var_name[var_name_len] = '\0';
-
-                /*** 1 : The same code (begin) ***/
-                char *rv;
-                if((rv = get_value_by_name(var_name)) != NULL){
-                    size_t substr_len = strlen(rv);
-                    if(new_cmd_pos + substr_len + 1 >= bufspace){
-                        size_t inc_bufspace = ((substr_len + BUF_SIZE - 1) / BUF_SIZE) * BUF_SIZE;
-                        new_cmdline = erealloc(new_cmdline, bufspace + inc_bufspace);
-                        bufspace += inc_bufspace;
-                    }
-                    strcpy(&new_cmdline[new_cmd_pos], rv);
-                    new_cmd_pos += substr_len;
-                }
-                cmd_pos_start = cmd_pos_end;
-                free(var_name);
-                /*** 1 : The same code (end) ***/
+
+    ct.nsegs = ct.nwords = ct.nstages = 0;
+    ct.background = 0;
+    ct_word_start = ct_stage_start = 0;
+    ct_re_fd = -1;
+
+    while((c = *s) != '\0'){
+        unsigned char cls = cc_table[(unsigned char) c];
+
+        /* A run of ordinary characters. */
+        if(!(cls & CC_STOP) && !(boundary && (cls & CC_DIGIT) && (s[1] == '<' || s[1] == '>'))){
+            const char *end = s + 1;
+            while(!(cc_table[(unsigned char) *end] & CC_STOP))
+                end++;
+            add_segment(SEG_LITERAL, s, end - s, NULL);
+            s = end;
+            boundary = 0;
+            continue;
+        }
+
+        if(cls & CC_BLANK){
+            end_tword();
+            s++;
+            boundary = 1;
+            continue;
+        }
+
+        if(c == '|'){
+            if(end_tstage() == -1)
+                return -1;
+            s++;
+            boundary = 1;
+            continue;
+        }
+
+        /* < and 0<    -    standard input
+         * > and 1>    -    standard output
+         * 2>          -    standard error
+         * >> and 1>>  -    standard output (append)
+         * 2>>         -    standard error (append)
+         */
+        if(c == '<' || c == '>' || (cls & CC_DIGIT)){
+            const char *op = s;
+            int fd = (c == '<') ? 0 : 1;
+            if(cls & CC_DIGIT){
+                fd = c - '0';
+                s++;
             }
-        }else{
-            ordinary_character:
-            if(new_cmd_pos + 1 >= bufspace){
-                new_cmdline = erealloc(new_cmdline, bufspace + BUF_SIZE);
-                bufspace += BUF_SIZE;
+            if((*s == '<' && fd != 0) || (*s == '>' && fd == 0) || fd > 2){
+                /* Not a redirection that the shell supports: 0> or 1< and so on. */
+                add_segment(SEG_LITERAL, op, s - op, NULL);
+                boundary = 0;
+                continue;
             }
-            new_cmdline[new_cmd_pos++] = c;
-            cmd_pos_start++;
+            int is_append = (s[0] == '>' && s[1] == '>');
+            s += is_append ? 2 : 1;
+
+            end_tword();
+            if(ct_re_fd != -1){
+                fprintf(stderr, "Error: missing file name for redirection\n");
+                return -1;
+            }
+            ct_re_fd = fd;
+            ct_re_append = is_append;
+            boundary = 1;
+            continue;
+        }
+
+        /* The code is not handle special cases, such as: '&' or '& ls'. */
+        if(c == '&' && rest_is_blank(s + 1)){
+            ct.background = 1;
+            break;
+        }
+
+        if(c == '~' && boundary){
+            s = compile_tilde(s, mem);
+            boundary = 0;
+            continue;
         }
+
+        if(c == '$'){
+            const char *next;
+            if((next = compile_variable(s, mem)) != NULL){
+                s = next;
+                boundary = 0;
+                continue;
+            }
+        }
+
+        /* An ordinary special character. */
+        add_segment(SEG_LITERAL, s, 1, NULL);
+        s++;
+        boundary = 0;
     }
-    new_cmdline[new_cmd_pos] = '\0';
-    /* End variable expand. */
-    
-    free(cmdline);
-    return new_cmdline;
+
+    return end_tstage();
 }
 
+/* $end template */
+
+
+/*********************
+ * Command cache (LRU)
+ ********************/
+/* $begin command cache */
+typedef struct cache_entry
+{
+    struct cache_entry *hnext;          /* next entry in the hash bucket */
+    struct cache_entry *prev, *next;    /* LRU list, the most recently used first */
+    unsigned long hash;
+    char *key;                          /* command text after history expansion */
+    size_t len;
+    cmd_template *tmpl;
+    arena mem;                          /* holds the entry, its key and its template */
+} cache_entry;
+
+static cache_entry *cache_table[CMDCACHE_BUCKETS];
+static cache_entry *lru_first = NULL;
+static cache_entry *lru_last = NULL;
+static size_t cache_count = 0;
+static unsigned long cache_lookups = 0;
+static unsigned long cache_hits = 0;
+static unsigned long cache_evictions = 0;
+
 
-/* < and 0<    -    1
- * > and 1>    -    2
- * 2>          -    3
- * >> and 1>>  -    4
- * 2>>         -    5
- */
 static
-int
-is_redirect (char * arg, int n)
-{
-    int rv = 0;
-    if(n == 1){ /* n == 1 */
-        if(arg[0] == '<')
-            rv = 1;
-        else if(arg[0] == '>')
-            rv = 2;
-    }else if(n == 2){   /* n == 2 */
-        if(arg[0] == '0' && arg[1] == '<')
-            rv = 1;
-        else if(arg[0] == '1' && arg[1] == '>')
-            rv = 2;
-        else if(arg[0] == '2' && arg[1] == '>')
-            rv = 3;
-        else if(arg[0] == '>' && arg[1] == '>')
-            rv = 4;
-    }else{  /* n == 3 */
-        if(arg[0] == '1' && arg[1] == '>' && arg[2] == '>')
-            rv = 4;
-        else if(arg[0] == '2' && arg[1] == '>' && arg[2] == '>')
-            rv = 5;
+void
+lru_unlink (cache_entry * e)
+{
+    if(e -> prev)
+        e -> prev -> next = e -> next;
+    else
+        lru_first = e -> next;
+    if(e -> next)
+        e -> next -> prev = e -> prev;
+    else
+        lru_last = e -> prev;
+}
+
+
+static
+void
+lru_push (cache_entry * e)
+{
+    e -> prev = NULL;
+    e -> next = lru_first;
+    if(lru_first)
+        lru_first -> prev = e;
+    else
+        lru_last = e;
+    lru_first = e;
+}
+
+
+static
+void
+cache_remove (cache_entry * e)
+{
+    cache_entry **pp = &cache_table[e -> hash % CMDCACHE_BUCKETS];
+    while(*pp != e)
+        pp = &((*pp) -> hnext);
+    *pp = e -> hnext;
+    lru_unlink(e);
+    cache_count--;
+
+    arena mem = e -> mem;
+    arena_free(&mem);
+}
+
+
+static
+cache_entry *
+cache_lookup (const char * key, size_t len, unsigned long hash)
+{
+    cache_entry *e;
+
+    cache_lookups++;
+    for(e = cache_table[hash % CMDCACHE_BUCKETS]; e; e = e -> hnext){
+        if(e -> hash == hash && e -> len == len && memcmp(e -> key, key, len) == 0){
+            cache_hits++;
+            lru_unlink(e);
+            lru_push(e);
+            return e;
+        }
     }
-    
-    return rv;
+    return NULL;
 }
 
 
+/* Compile the command text key and add it to the cache. Return NULL if failed. */
 static
+cache_entry *
+cache_insert (const char * key, size_t len, unsigned long hash)
+{
+    arena mem;
+    arena_init(&mem);
+    cache_entry *e = arena_alloc(&mem, sizeof(cache_entry));
+    e -> key = arena_strdup(&mem, key, len);
+
+    if((e -> tmpl = compile_text(e -> key, &mem)) == NULL){
+        arena_free(&mem);
+        return NULL;
+    }
+
+    if(cache_count >= CMDCACHE_SIZE){
+        cache_remove(lru_last);
+        cache_evictions++;
+    }
+
+    e -> mem = mem;
+    e -> hash = hash;
+    e -> len = len;
+    e -> hnext = cache_table[hash % CMDCACHE_BUCKETS];
+    cache_table[hash % CMDCACHE_BUCKETS] = e;
+    lru_push(e);
+    cache_count++;
+    return e;
+}
+
+
+/* Remove all compiled commands from the cache. */
+void
+clear_cmdcache (void)
+{
+    while(lru_first != NULL)
+        cache_remove(lru_first);
+}
+
+
 void
-record_redirect (int flag, process * ps, char * filename)
+print_cmdcache_stats (void)
+{
+    printf("entries:   %zu of %d\n", cache_count, CMDCACHE_SIZE);
+    printf("lookups:   %lu\n", cache_lookups);
+    printf("hits:      %lu (%.1f%%)\n", cache_hits,
+           cache_lookups ? 100.0 * cache_hits / cache_lookups : 0.0);
+    printf("misses:    %lu\n", cache_lookups - cache_hits);
+    printf("evictions: %lu\n", cache_evictions);
+}
+
+/* $end command cache */
+
+
+/**************
+ * Expansion
+ *************/
+/* $begin expansion */
+/* A word of the command line after expansion. fd is -1 for an argument,
+ * otherwise the word is the file name of a redirection of fd.
+ */
+typedef struct token
 {
-    int index;
+    size_t offset;      /* offset of the word in lexer.words */
+    size_t len;
+    int fd;
     int is_append;
+} token;
+
+typedef struct lexer
+{
+    strbuf text;        /* the command line with extra blanks removed and history expanded */
+    strbuf words;       /* the expanded words, one after another */
+    token *tokens;
+    size_t ntokens, tokens_size;
+    size_t *stages;     /* index of the first token of each process */
+    size_t nstages, stages_size;
+    size_t stage_start; /* first token of the process being expanded */
+    size_t word_start;  /* offset of the word being expanded in lexer.words */
+    int in_word;        /* true if a word has been started in lexer.words */
+    int space_pending;  /* true if a blank separates the next character from lexer.text */
+    int re_fd;          /* redirection of the word being expanded, or -1 */
+    int re_append;
+    int hist_expanded;
+} lexer;
+
+/* The scratch buffers are reused by every command. */
+static lexer lx;
+
+/* History is only expanded and recorded if this is true: not in a shell that is not 
+ * interactive, as in bash, nor while the rc file runs.
+ */
+int record_history = 1;
 
-    switch (flag) {
-        case 1: { index = 0; is_append = 0; break; }
-        case 2: { index = 1; is_append = 0; break; }
-        case 3: { index = 2; is_append = 0; break; }
-        case 4: { index = 1; is_append = 1; break; }
-        case 5: { index = 2; is_append = 1; break; }
-        default: assert(0);
+
+static
+void
+put_text (const char * p, size_t n)
+{
+    if(lx.space_pending){
+        sb_putc(&lx.text, ' ');
+        lx.space_pending = 0;
     }
+    sb_put(&lx.text, p, n);
+}
 
-    if(((ps -> io_re)[index]).dest == NULL){
-        ((ps -> io_re)[index]).dest = filename;
-    }else{
-        free(((ps -> io_re)[index]).dest);
-        ((ps -> io_re)[index]).dest = filename;
+
+static
+void
+put_word (const char * p, size_t n)
+{
+    if(!lx.in_word){
+        lx.in_word = 1;
+        lx.word_start = lx.words.len;
     }
-    ((ps -> io_re)[index]).is_append = is_append;
+    sb_put(&lx.words, p, n);
 }
 
 
 static
 void
-add_process (char * cmdline)
+end_word (void)
 {
-    size_t cmd_len = strlen(cmdline);
-    /* The code is not handle special cases, such as: 
-     * '&' or '& ls'.
-     */
-    if(cmdline[cmd_len-1] == '&'){
-        foreground = 0;
-        cmdline[cmd_len-1] = '\0';
-        cmd_len--;
-    }else
-        foreground = 1;
-
-    int process_start = 0;
-    int process_end = 0;
-    int start = 0;
-    int end = 0;
-    /* The pipe uses an error when the left or right side of the pipe is empty, but the 
-     * shell ignores these error cases. Empty means no characters or only blank, such as: 
-     * '|' or '| ls' or 'ls |' or 'ls || sort'  or 'ls |   | sort'.
-     */
-    while(cmdline[process_start]){
-        process_end = process_start;
-        char tmp_c;
-        int count = 0;
-        while((tmp_c = cmdline[process_end]) != '|' && tmp_c != '\0'){
-            if(!isblank(tmp_c))
-                count++;
-            process_end++;
+    if(!lx.in_word)
+        return;
+    lx.in_word = 0;
+
+    grow_array((void **) &lx.tokens, &lx.tokens_size, lx.ntokens, sizeof(token));
+    token *t = &lx.tokens[lx.ntokens++];
+    t -> offset = lx.word_start;
+    t -> len = lx.words.len - lx.word_start;
+    t -> fd = lx.re_fd;
+    t -> is_append = lx.re_append;
+    lx.re_fd = -1;
+}
+
+
+/* Append the value of a variable to the words, splitting it on blanks. */
+static
+void
+put_value (const char * value)
+{
+    const char *p = value;
+
+    while(*p){
+        if(cc_table[(unsigned char) *p] & CC_BLANK){
+            end_word();
+            p++;
+            continue;
         }
+        const char *q = p;
+        while(!(cc_table[(unsigned char) *q] & (CC_BLANK | CC_END)))
+            q++;
+        put_word(p, q - p);
+        p = q;
+    }
+}
+
+
+/* Remove extra blanks from the command line s and expand its history references.
+ * Return 0 if success, -1 if failed.
+ */
+static
+int
+expand_history (const char * s)
+{
+    char c;
 
-        if(count == 0){
-            if(tmp_c == '|')
-                process_start = process_end + 1;
-            else
-                process_start = process_end;
+    while((c = *s) != '\0'){
+        if(cc_table[(unsigned char) c] & CC_BLANK){
+            if(lx.text.len > 0)
+                lx.space_pending = 1;
+            s++;
             continue;
         }
 
-        /* Malloc and initial the process. */
-        process *ps = emalloc(sizeof(process));
-        ps -> next = NULL;
-        ps -> argv = emalloc(sizeof(char*) * ARGV_SIZ);
-        size_t bufspace = ARGV_SIZ;
-        int bufpos = 0;
-        ((ps -> io_re)[0]).dest = NULL;
-        ((ps -> io_re)[1]).dest = NULL;
-        ((ps -> io_re)[2]).dest = NULL;
-        ps -> pid = -1;
-        ps -> completed = 0;
-        ps -> stopped = 0;
-
-        if(current_job -> first_process == NULL)
-            current_job -> first_process = ps;
-        else{
-            process *p = current_job -> first_process;
-            while(p -> next != NULL)
-                p = p -> next;
-            p -> next = ps;
+        if(c == '!' && record_history && (cc_table[(unsigned char) s[1]] & CC_DIGIT)){
+            char *end;
+            long hist_index = strtol(s + 1, &end, 10);
+            char *rv;
+            if(hist_index > INT_MAX || (rv = get_hist((int) hist_index)) == (char *) -1){
+                fprintf(stderr, "Error: history expand failed\n");
+                return -1;
+            }
+            put_text(rv, strlen(rv));
+            lx.hist_expanded = 1;
+            s = end;
+            continue;
         }
 
+        /* !?string? is the newest entry containing string, !string the newest one 
+         * starting with string.
+         */
+        if(c == '!' && record_history && !(cc_table[(unsigned char) s[1]] & (CC_BLANK | CC_END))
+           && s[1] != '='){
+            const char *word = s + 1, *end;
+            int prefix = (*word != '?');
+            int hist_index;
+            if(prefix){
+                for(end = word; !(cc_table[(unsigned char) *end] & (CC_BLANK | CC_END)); end++)
+                    ;
+            }else{
+                word++;
+                if((end = strchr(word, '?')) == NULL)
+                    end = word + strlen(word);
+            }
+            if((hist_index = search_hist(word, end - word, prefix, 0)) == 0){
+                fprintf(stderr, "Error: history expand failed: !%s%.*s: event not found\n", 
+                        prefix ? "" : "?", (int) (end - word), word);
+                return -1;
+            }
+            char *rv = get_hist(hist_index);
+            put_text(rv, strlen(rv));
+            lx.hist_expanded = 1;
+            s = (!prefix && *end == '?') ? end + 1 : end;
+            continue;
+        }
 
-        start = process_start;
-        int flag = 0;
-        while(start < process_end){
-            if(!isblank(cmdline[start])){
-                end = start + 1;
-                while(end < process_end && !isblank(cmdline[end]))
-                    end++;
-
-                size_t arg_len = end - start;
-                if(flag > 0){
-                    char *filename = emalloc(arg_len+1);
-                    strncpy(filename, &cmdline[start], arg_len);
-                    filename[arg_len] = '\0';
-
-                    record_redirect(flag, ps, filename);
-                    flag = 0;
-                    start = end;
-                    continue;
-                }
+        const char *end = s + 1;
+        while(!(cc_table[(unsigned char) *end] & (CC_BLANK | CC_END)) && *end != '!')
+            end++;
+        put_text(s, end - s);
+        s = end;
+    }
+
+    sb_putc(&lx.text, '\0');
+    return 0;
+}
+
+
+/* Expand the template t into the tokens and processes of the scanner.
+ * Return 0 if success, -1 if failed.
+ */
+static
+int
+expand_template (const cmd_template * t)
+{
+    size_t i, k, m;
 
-                if(arg_len <= 3 && (flag = is_redirect(&cmdline[start], arg_len)) > 0){
-                    start = end;
-                    continue;
+    lx.words.len = 0;
+    lx.ntokens = 0;
+    lx.nstages = 0;
+    lx.in_word = 0;
+
+    for(i = 0; i < t -> nstages; i++){
+        const tstage *st = &(t -> stages)[i];
+        lx.stage_start = lx.ntokens;
+
+        for(k = st -> first_word; k < st -> first_word + st -> nwords; k++){
+            const tword *w = &(t -> words)[k];
+            lx.re_fd = w -> fd;
+            lx.re_append = w -> is_append;
+
+            for(m = w -> first_seg; m < w -> first_seg + w -> nsegs; m++){
+                const segment *seg = &(t -> segs)[m];
+                switch (seg -> kind) {
+                    case SEG_LITERAL: {
+                        put_word(seg -> s, seg -> len);
+                        break;
+                    }
+                    case SEG_VARIABLE: {
+                        char *rv;
+                        if(strcmp(seg -> name, "?") == 0){
+                            char buf[16];
+                            snprintf(buf, sizeof(buf), "%d", last_status);
+                            put_word(buf, strlen(buf));
+                        }else{
+                            if(snapshot_recording)
+                                snapshot_depend(seg -> name);
+                            if((rv = get_value_by_name(seg -> name)) != NULL)
+                                put_value(rv);
+                        }
+                        break;
+                    }
+                    case SEG_TILDE: {
+                        char *username = seg -> name;
+                        struct passwd *rv;
+                        unsigned long long t;
+                        if(snapshot_recording)
+                            snapshot_invalidate();  /* depends on the user database */
+                        TRACE_BEGIN(t);
+                        if(*username == '\0')
+                            username = getlogin();  /* If return NULL ? */
+                        rv = (username != NULL) ? getpwnam(username) : NULL;
+                        TRACE_END(t, "getpwnam", username);
+                        if(rv != NULL)
+                            put_word(rv -> pw_dir, strlen(rv -> pw_dir));
+                        else
+                            put_word(seg -> s, seg -> len);
+                        break;
+                    }
                 }
+            }
 
-                char *arg = emalloc(arg_len+1);
-                strncpy(arg, &cmdline[start], arg_len);
-                arg[arg_len] = '\0';
+            end_word();
+            if(lx.re_fd != -1){
+                fprintf(stderr, "Error: missing file name for redirection\n");
+                return -1;
+            }
+        }
 
-                if(bufpos + 1 >= bufspace){
-                    ps -> argv = erealloc(ps -> argv, sizeof(char*) * (bufspace + ARGV_SIZ));
-                    bufspace += ARGV_SIZ;
+        /* Processes whose words all expanded to nothing are ignored. */
+        if(lx.ntokens == lx.stage_start)
+            continue;
+        grow_array((void **) &lx.stages, &lx.stages_size, lx.nstages, sizeof(size_t));
+        lx.stages[lx.nstages++] = lx.stage_start;
+    }
+
+    return 0;
+}
+
+/* $end expansion */
+
+
+static
+void
+add_job (const char * command, size_t len)
+{
+    arena mem;
+    arena_init(&mem);
+    job *new_job = arena_alloc(&mem, sizeof(job));
+    new_job -> mem = mem;
+
+    new_job -> command = arena_strdup(&(new_job -> mem), command, len);
+    new_job -> first_process = NULL;
+    new_job -> pgid = 0;
+    new_job -> notified = 0;
+    new_job -> tmodes = shell_tmodes;
+    new_job -> stdin = STDIN_FILENO;
+    new_job -> stdout = STDOUT_FILENO;
+    new_job -> stderr = STDERR_FILENO;
+    new_job -> stats = NULL;
+    new_job -> nstats = 0;
+    new_job -> timed = 0;
+    new_job -> background = 0;
+
+    insert_job(new_job);   /* gives it a jid */
+    current_job = new_job;
+}
+
+
+/* Build the process for the tokens [first, last) of the scanner in the arena of j. */
+static
+process *
+add_process (job * j, size_t first, size_t last)
+{
+    size_t argc = 0;
+    size_t bytes = 0;
+    size_t i, k;
+    size_t cmd = last;      /* token of the command name */
+    const alias *chain[MAX_ALIAS_DEPTH];
+    size_t nalias = 0;
+
+    for(i = first; i < last; i++){
+        if(lx.tokens[i].fd == -1){
+            if(argc++ == 0)
+                cmd = i;
+        }
+        bytes += lx.tokens[i].len + 1;
+    }
+
+    /* The words of the aliases take the place of the command name: all the words of 
+     * the innermost one, followed by the arguments of the others.
+     */
+    if(cmd != last
+       && (nalias = resolve_alias(&(lx.words.s)[lx.tokens[cmd].offset], lx.tokens[cmd].len, chain)) > 0){
+        argc--;
+        bytes -= lx.tokens[cmd].len + 1;
+        for(k = 0; k < nalias; k++){
+            argc += chain[k] -> argc;
+            bytes += chain[k] -> bytes;
+            if(k < nalias - 1){
+                argc--;
+                bytes -= strlen((chain[k] -> argv)[0]) + 1;
+            }
+        }
+    }
+
+    process *ps = arena_alloc(&(j -> mem), sizeof(process));
+    ps -> next = NULL;
+    /* The argv array is followed by the argument strings and redirection file names. */
+    ps -> argv = arena_alloc(&(j -> mem), sizeof(char*) * (argc + 1) + bytes);
+    ((ps -> io_re)[0]).dest = NULL;
+    ((ps -> io_re)[1]).dest = NULL;
+    ((ps -> io_re)[2]).dest = NULL;
+    ps -> pid = -1;
+    ps -> completed = 0;
+    ps -> stopped = 0;
+    ps -> stats = NULL;
+    memset(&(ps -> start), 0, sizeof(ps -> start));
+    memset(&(ps -> end), 0, sizeof(ps -> end));
+    memset(&(ps -> ru), 0, sizeof(ps -> ru));
+
+    char *word = (char *) &(ps -> argv)[argc + 1];
+    size_t argpos = 0;
+    for(i = first; i < last; i++){
+        token *t = &lx.tokens[i];
+        if(i == cmd && nalias > 0){
+            for(k = nalias; k-- > 0; ){
+                char **arg;
+                for(arg = (chain[k] -> argv) + (k < nalias - 1); *arg != NULL; arg++){
+                    size_t len = strlen(*arg);
+                    memcpy(word, *arg, len + 1);
+                    (ps -> argv)[argpos++] = word;
+                    word += len + 1;
                 }
-                (ps -> argv)[bufpos++] = arg;
-                start = end;
-            }else
-                start++;
+            }
+            continue;
+        }
+        memcpy(word, &(lx.words.s)[t -> offset], t -> len);
+        word[t -> len] = '\0';
+        if(t -> fd == -1){
+            (ps -> argv)[argpos++] = word;
+        }else{  /* the last redirection of a channel wins */
+            ((ps -> io_re)[t -> fd]).dest = word;
+            ((ps -> io_re)[t -> fd]).is_append = t -> is_append;
         }
-        (ps -> argv)[bufpos] = NULL;
+        word += t -> len + 1;
+    }
+    (ps -> argv)[argpos] = NULL;
 
-        if(tmp_c == '|')
-            process_start = process_end + 1;
-        else
-            process_start = process_end;
+    return ps;
+}
+
+
+/* Squeeze the blanks of the command line cmdline and expand its history references, 
+ * adding the result to the history list. Return the text, which is only valid until 
+ * the next call, and store its length in *len. Return NULL if failed.
+ */
+char *
+scan_cmd (char * cmdline, size_t * len)
+{
+    unsigned long long t;
+
+    if(cc_table[' '] == 0)
+        init_cc_table();
+
+    lx.text.len = 0;
+    lx.space_pending = 0;
+    lx.hist_expanded = 0;
+
+    TRACE_BEGIN(t);
+    if(expand_history(cmdline) == -1)
+        return NULL;
+
+    /* If history expand success. */
+    if(lx.hist_expanded){
+        printf("%s\n", lx.text.s);
+        if(snapshot_recording)
+            snapshot_invalidate();
     }
 
-    free(cmdline);
+    if(record_history)
+        add_hist(lx.text.s);
+    TRACE_END(t, "history", NULL);
+
+    *len = lx.text.len - 1;
+    return lx.text.s;
 }
 
 
-/* int eval_cmd (char * cmdline) : 
- *   1.history expand; 2.add history entry, add job entry;
- *   3.tilde expand; 4.variable expand; 5.add process entry.
+/* Compile the command text into a template allocated from mem. The template refers 
+ * to the text, which must live as long as it. Return NULL if failed.
  */
-int
-eval_cmd (char * cmdline)
+cmd_template *
+compile_text (const char * text, arena * mem)
 {
-    char *temp_cmdline;
+    if(cc_table[' '] == 0)
+        init_cc_table();
+    if(compile_cmd(text, mem) == -1)
+        return NULL;
+
+    /* Copy the template out of the scratch arrays. */
+    cmd_template *t = arena_alloc(mem, sizeof(cmd_template));
+    *t = ct;
+    t -> segs = arena_alloc(mem, sizeof(segment) * ct.nsegs);
+    memcpy(t -> segs, ct.segs, sizeof(segment) * ct.nsegs);
+    t -> words = arena_alloc(mem, sizeof(tword) * ct.nwords);
+    memcpy(t -> words, ct.words, sizeof(tword) * ct.nwords);
+    t -> stages = arena_alloc(mem, sizeof(tstage) * ct.nstages);
+    memcpy(t -> stages, ct.stages, sizeof(tstage) * ct.nstages);
+    return t;
+}
 
-    temp_cmdline = delete_extra_blank(cmdline);
 
-    if((temp_cmdline = history_expand(temp_cmdline)) == (char *) -1)
+/* Expand the template t into the new job current_job, with the command text (len bytes). 
+ * Return 1 if success, 0 if there is nothing to run and -1 if failed.
+ */
+int
+instantiate_cmd (const cmd_template * t, const char * text, size_t len)
+{
+    unsigned long long tr;
+
+    TRACE_BEGIN(tr);
+    if(expand_template(t) == -1)
         return -1;
+    TRACE_END(tr, "expand", NULL);
 
-    size_t tmp_cmdln_len = strlen(temp_cmdline) + 1;
+    if(lx.nstages == 0)
+        return 0;   /* nothing to run, such as '|' or '&' */
 
-    add_hist(temp_cmdline);
+    TRACE_BEGIN(tr);
+    add_job(text, len);
+    foreground = !(t -> background);
 
-    char *command = emalloc(tmp_cmdln_len);
-    strcpy(command, temp_cmdline);
-    add_job(command);
+    process **pp = &(current_job -> first_process);
+    size_t i;
+    for(i = 0; i < lx.nstages; i++){
+        size_t last = (i + 1 < lx.nstages) ? lx.stages[i + 1] : lx.ntokens;
+        *pp = add_process(current_job, lx.stages[i], last);
+        pp = &((*pp) -> next);
+    }
+    TRACE_END(tr, "build job", NULL);
 
-    temp_cmdline = emalloc(tmp_cmdln_len);
-    strcpy(temp_cmdline, command);
-    temp_cmdline = tilde_expand(temp_cmdline);
+    return 1;
+}
+
+
+/* Expand the template t into a NULL-terminated array of its words, allocated from mem. 
+ * Redirections and the boundaries of the processes are ignored. Return NULL if failed.
+ */
+char **
+expand_args (const cmd_template * t, arena * mem)
+{
+    size_t argc = 0, i;
 
-    temp_cmdline = variable_expand(temp_cmdline);
+    if(expand_template(t) == -1)
+        return NULL;
 
-    add_process(temp_cmdline);
+    for(i = 0; i < lx.ntokens; i++)
+        if(lx.tokens[i].fd == -1)
+            argc++;
 
+    char **argv = arena_alloc(mem, sizeof(char *) * (argc + 1));
+    argc = 0;
+    for(i = 0; i < lx.ntokens; i++)
+        if(lx.tokens[i].fd == -1)
+            argv[argc++] = arena_strdup(mem, &(lx.words.s)[lx.tokens[i].offset], lx.tokens[i].len);
+    argv[argc] = NULL;
+    return argv;
+}
+
+
+/* int eval_cmd (char * cmdline) :
+ *   1.remove extra blanks and expand history; 2.add history entry;
+ *   3.find or compile the command template; 4.expand tildes and variables;
+ *   5.add job and process entries.
+ */
+int
+eval_cmd (char * cmdline)
+{
+    unsigned long long t;
+    char *text;
+    size_t len;
+
+    if((text = scan_cmd(cmdline, &len)) == NULL)
+        return -1;
+
+    TRACE_BEGIN(t);
+    unsigned long hash = hash_bytes(text, len);
+    cache_entry *e;
+    if((e = cache_lookup(text, len, hash)) != NULL){
+        TRACE_END(t, "cmdcache hit", NULL);
+    }else{
+        if((e = cache_insert(text, len, hash)) == NULL)
+            return -1;
+        TRACE_END(t, "compile", NULL);
+    }
+
+    if(instantiate_cmd(e -> tmpl, text, len) != 1)
+        return -1;
     return 0;
 }
 
 
-/* $end eval_cmd.c */
\ No newline at end of file
+/* $end eval_cmd.c */
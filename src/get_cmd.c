@@ -1,42 +1,177 @@
 /* 
  * get_cmd.c
+ *
+ * Note: 
+ *   Command input is read with read() in blocks of INPUT_BLOCK bytes into a single buffer 
+ *   that is reused for the whole session, and next_cmd() returns lines that point into 
+ *   that buffer. A terminal returns at most one line per read(), so the interactive case 
+ *   behaves as before; scripts and pipes are consumed at I/O speed.
  */
 /* $begin get_cmd.c */
 #include <stdio.h>
+#include <string.h>
 #include <ctype.h>
+#include <unistd.h>
+#include <errno.h>
+#include <poll.h>
 #include "myshell.h"
 #include "wrapper.h"
 
 
-char *
-next_cmd (char * prompt, FILE * fp)
+static int    input_fd       = STDIN_FILENO;
+static char * input_buf      = NULL;	/* reusable input/line buffer */
+static size_t input_bufspace = 0;
+static size_t input_pos      = 0;		/* start of the unconsumed input */
+static size_t input_end      = 0;		/* end of the buffered input */
+static int    input_eof      = 0;
+static int    input_pushed   = 0;		/* the next line came from push_cmd() */
+static char * input_prompt   = NULL;	/* the prompt of the line being read */
+
+
+static
+void
+reserve_input (size_t n)
+{
+	if(input_end + n + 1 > input_bufspace){
+		size_t bufspace = input_bufspace ? input_bufspace : INPUT_BLOCK;
+		while(input_end + n + 1 > bufspace)
+			bufspace *= 2;
+		input_buf = erealloc(input_buf, bufspace);
+		input_bufspace = bufspace;
+	}
+}
+
+
+/* Read the next block of input, keeping the unconsumed bytes at the start of the buffer. */
+static
+void
+fill_input (void)
 {
-	char *buf = NULL;
-	int bufspace = 0;
-	int pos = 0;
-	int c;
-
-	printf("%s", prompt);
-	while((c = getc(fp)) != EOF){
-		if(pos + 1 >= bufspace){
-			if(bufspace == 0)
-				buf = emalloc(BUF_SIZE);
-			else
-				buf = erealloc(buf, bufspace + BUF_SIZE);
-			bufspace += BUF_SIZE;
+	ssize_t n;
+
+	if(input_pos > 0){
+		memmove(input_buf, &input_buf[input_pos], input_end - input_pos);
+		input_end -= input_pos;
+		input_pos = 0;
+	}
+	reserve_input(INPUT_BLOCK);
+
+	/* While there is no input, handle the children that change state. A notification 
+	 * (set -b) ends up below the prompt, so the prompt is printed again.
+	 */
+	int child_fd = child_event_fd();
+	if(child_fd != -1){
+		struct pollfd fds[2] = {{input_fd, POLLIN, 0}, {child_fd, POLLIN, 0}};
+		for(;;){
+			if(poll(fds, 2, -1) == -1){
+				if(errno == EINTR)
+					continue;
+				break;
+			}
+			if(fds[1].revents & POLLIN){
+				if(child_event() && input_prompt != NULL){
+					printf("%s", input_prompt);
+					fflush(stdout);
+				}
+			}
+			if(fds[0].revents != 0)
+				break;
 		}
+	}
 
-		if(c == '\n')
-			break;
+	do{
+		n = read(input_fd, &input_buf[input_end], input_bufspace - input_end - 1);
+	}while(n == -1 && errno == EINTR);
 
-		buf[pos++] = c;
+	if(n > 0){
+		input_end += n;
+	}else{
+		if(n == -1)
+			perror("read");
+		input_eof = 1;
 	}
+}
+
+
+/* Read commands from the file descriptor fd. */
+void
+set_input_fd (int fd)
+{
+	input_fd = fd;
+	input_pos = input_end = 0;
+	input_eof = 0;
+}
 
-	if(c == EOF && pos == 0)
-		return NULL;
 
-	buf[pos] = '\0';
-	return buf;
+/* Read commands from the string s (myshell -c). */
+void
+set_input_string (char * s)
+{
+	size_t len = strlen(s);
+
+	input_fd = -1;
+	input_pos = input_end = 0;
+	reserve_input(len);
+	memcpy(input_buf, s, len);
+	input_end = len;
+	input_eof = 1;
+}
+
+
+/* Make a copy of line the next line returned by next_cmd(), which prints no prompt for it. 
+ * Lines returned before are no longer valid.
+ */
+void
+push_cmd (const char * line)
+{
+	size_t len = strlen(line);
+
+	reserve_input(len + 1);
+	memmove(&input_buf[input_pos + len + 1], &input_buf[input_pos], input_end - input_pos);
+	memcpy(&input_buf[input_pos], line, len);
+	input_buf[input_pos + len] = '\n';
+	input_end += len + 1;
+	input_pushed = 1;
+}
+
+
+/* Return the next line of input without its newline, or NULL at end of input. 
+ * The line is only valid until the next call. No prompt is printed if prompt is NULL.
+ */
+char *
+next_cmd (char * prompt)
+{
+	size_t scanned = input_pos;
+	char *line, *nl;
+
+	if(prompt != NULL && !input_pushed){
+		printf("%s", prompt);
+		fflush(stdout);
+	}
+	input_pushed = 0;
+	input_prompt = prompt;
+
+	for(;;){
+		if(scanned < input_end 
+		   && (nl = memchr(&input_buf[scanned], '\n', input_end - scanned)) != NULL){
+			*nl = '\0';
+			line = &input_buf[input_pos];
+			input_pos = nl - input_buf + 1;
+			return line;
+		}
+
+		if(input_eof){
+			if(input_pos == input_end)
+				return NULL;
+			input_buf[input_end] = '\0';	/* fill_input() always leaves room */
+			line = &input_buf[input_pos];
+			input_pos = input_end;
+			return line;
+		}
+
+		scanned = input_end - input_pos;	/* fill_input() moves the data to offset 0 */
+		fill_input();
+	}
 }
 
 
@@ -55,4 +190,4 @@ cmd_is_empty (char * cmdline)
 }
 
 
-/* $end get_cmd.c */
\ No newline at end of file
+/* $end get_cmd.c */
@@ -1,69 +1,1045 @@
 /* 
  * historylib.c
+ *
+ * Note: 
+ *   The history list holds the last hist_size entries (HISTSIZE). The text of the entries 
+ *   is kept in one contiguous ring of bytes, and an index ring of offset/length pairs 
+ *   locates each entry, so the list costs no allocation per entry.
+ *   The history can be kept in a file of append-only records. add_hist() appends each 
+ *   entry with a single write(). At startup init_hist() only maps the file: the records 
+ *   are read the first time the history list is used (history, !N), and then only the 
+ *   last hist_size of them, found by walking the record trailers backwards.
+ *   search_hist() finds entries by prefix or substring through a trigram index that 
+ *   add_hist() keeps up to date, so it does not scan the whole list.
+ *   With HISTCONTROL=erasedups an entry erases the older entries with the same text, 
+ *   found through a hash set of the entries. An erased entry stays in the list as a 
+ *   tombstone that is not numbered: a Fenwick tree over the slots counts the live 
+ *   entries, so the entry numbers are the same as history shows.
+ *   With HISTSHARE set, several sessions share the history file. A session does not 
+ *   add its own entries to the list: before the list is used, sync_hist() reads the 
+ *   records appended to the file since the last time, its own ones included, so every 
+ *   session sees all the entries in the order they were appended. The writes need no 
+ *   lock, as a record is appended with a single write() to a file opened with O_APPEND.
  */
 /* $begin historylib.c */
+#define _POSIX_C_SOURCE 200809L	/* for O_CLOEXEC and mmap(), see FEATURE_TEST_MACROS(7) */
+
 #include <stdio.h>
 #include <stdlib.h>
+#include <string.h>
+#include <stdint.h>
+#include <time.h>
+#include <errno.h>
+#include <fcntl.h>
+#include <unistd.h>
+#include <sys/types.h>
+#include <sys/stat.h>
+#include <sys/mman.h>
+#include "historylib.h"
+#include "wrapper.h"
+
+#define HIST_SIZE		500			/* default number of entries */
+#define HIST_ENTRY_AVG	64			/* initial bytes of the ring per entry */
+#define HIST_RING_MIN	4096		/* entries the ring and the slots have room for at first */
+#define HIST_OUT_BUF	65536		/* output buffer of print_hist_list() */
+
+typedef struct hist_entry
+{
+	size_t off;						/* offset of the entry in hist_ring */
+	size_t len;						/* length of the entry, without its '\0' */
+	uint32_t hash;					/* hash of the text of the entry */
+	uint32_t erased;				/* the entry is a tombstone */
+} hist_entry;
+
+/* The slots of hist_entries are twice the entries they have room for, so tombstones 
+ * are compacted only after as many erasures. The room grows with the list, up to 
+ * hist_size, so a large HISTSIZE costs nothing until the entries are there.
+ */
+static char *       hist_ring     = NULL;	/* the text of the entries, each ending with '\0' */
+static size_t       hist_ring_len = 0;
+static size_t       ring_tail     = 0;		/* where the next entry goes in hist_ring */
+static hist_entry * hist_entries  = NULL;	/* the entries, the oldest at hist_first */
+static int *        live_tree     = NULL;	/* Fenwick tree of the live slots of hist_entries */
+static size_t       hist_size     = HIST_SIZE;
+static size_t       hist_slots    = 0;		/* number of slots of hist_entries */
+static size_t       hist_first    = 0;
+static size_t       hist_count    = 0;		/* entries in the list, with the tombstones */
+static size_t       hist_live     = 0;		/* entries that are not erased */
+static uint32_t     hist_seq      = 0;		/* sequence number of the oldest entry */
+
+/* HISTCONTROL */
+#define HC_IGNOREDUPS	1			/* do not add an entry equal to the last one */
+#define HC_ERASEDUPS	2			/* erase the older entries equal to a new one */
+
+static int hist_control = 0;
+
+
+/* With HC_ERASEDUPS, the hash set of the entries maps the hash of the text to 
+ * the sequence number of each live entry.
+ */
+#define DUP_EMPTY		0xffffffffU
+#define DUP_DELETED		0xfffffffeU
+#define DUP_TABLE_MIN	64			/* initial number of slots, a power of 2 */
+
+typedef struct dup_slot
+{
+	uint32_t hash;
+	uint32_t seq;					/* DUP_EMPTY or DUP_DELETED if the slot is free */
+} dup_slot;
+
+static dup_slot * dup_table      = NULL;
+static size_t     dup_table_size = 0;
+static size_t     dup_used       = 0;	/* slots that are not empty, with the deleted ones */
+
+
+/* The search index maps every trigram of the entries to the ascending list of the 
+ * sequence numbers of the entries that contain it. An entry is indexed with two 
+ * GRAM_ANCHOR bytes in front, so that its first trigrams serve the prefix searches. 
+ * The oldest entry is at the start of the lists of all its trigrams, so dropping it 
+ * only advances the start of these lists.
+ */
+#define GRAM_ANCHOR		'\1'
+#define GRAM_TABLE_MIN	1024		/* initial number of slots, a power of 2 */
+
+typedef struct gram_list
+{
+	uint32_t key;			/* the trigram + 1, 0 if the slot is empty */
+	uint32_t start;			/* first live sequence number in seqs */
+	uint32_t len;
+	uint32_t cap;
+	uint32_t *seqs;
+} gram_list;
+
+static gram_list * gram_table      = NULL;
+static size_t      gram_table_size = 0;
+static size_t      gram_count      = 0;
+
+/* Shift the byte c into the trigram k. */
+#define NEXT_GRAM(k, c)	((((k) << 8) | (unsigned char) (c)) & 0xffffff)
+
+
+/* A record of the history file is a hist_head, the entry and its '\0' padded 
+ * to a multiple of 8 bytes, and a hist_tail.
+ */
+#define HIST_MAGIC		0x3148534dU		/* "MSH1" */
+
+typedef struct hist_head
+{
+	uint32_t magic;
+	uint32_t len;			/* length of the entry */
+	int64_t  time;			/* when the entry was added */
+} hist_head;
+
+typedef struct hist_tail
+{
+	uint32_t size;			/* size of the whole record */
+	uint32_t magic;
+} hist_tail;
+
+#define RECORD_SIZE(len)	(sizeof(hist_head) + (((len) + 1 + 7) & ~(size_t) 7) + sizeof(hist_tail))
+
+static int    hist_fd      = -1;		/* the history file, opened with O_APPEND */
+static char * hist_map     = NULL;		/* the history file as it was at startup */
+static size_t hist_map_len = 0;
+static int    hist_loaded  = 1;			/* false until the records of hist_map are read */
+static int    hist_shared  = 0;			/* HISTSHARE */
+static off_t  hist_sync_off = 0;		/* the records before this offset are in the list */
+
+
+/* Return the entry i (0 is the oldest), counting the tombstones. */
+#define ENTRY(i)		(&hist_entries[(hist_first + (i)) % hist_slots])
+
+
+#define GRAM_SLOT(key)	(((key) * 0x9e3779b1U) & (gram_table_size - 1))
+
+/* Return the list of the trigram key, creating it if create is true, or NULL. */
+static
+gram_list *
+find_gram (uint32_t key, int create)
+{
+	size_t i;
+
+	if(gram_table_size == 0){
+		if(!create)
+			return NULL;
+		gram_table_size = GRAM_TABLE_MIN;
+		gram_table = emalloc(sizeof(gram_list) * gram_table_size);
+		memset(gram_table, 0, sizeof(gram_list) * gram_table_size);
+	}
+
+	for(i = GRAM_SLOT(key); gram_table[i].key != 0; i = (i + 1) & (gram_table_size - 1))
+		if(gram_table[i].key == key)
+			return &gram_table[i];
+	if(!create)
+		return NULL;
+
+	if((gram_count + 1) * 4 > gram_table_size * 3){
+		gram_list *old = gram_table;
+		size_t old_size = gram_table_size;
+		gram_table_size *= 2;
+		gram_table = emalloc(sizeof(gram_list) * gram_table_size);
+		memset(gram_table, 0, sizeof(gram_list) * gram_table_size);
+		for(i = 0; i < old_size; i++){
+			if(old[i].key != 0){
+				size_t k = GRAM_SLOT(old[i].key);
+				while(gram_table[k].key != 0)
+					k = (k + 1) & (gram_table_size - 1);
+				gram_table[k] = old[i];
+			}
+		}
+		free(old);
+		for(i = GRAM_SLOT(key); gram_table[i].key != 0; i = (i + 1) & (gram_table_size - 1))
+			;
+	}
+
+	gram_count++;
+	gram_table[i].key = key;
+	return &gram_table[i];
+}
+
+
+/* Add the entry hist with the sequence number seq to the search index. */
+static
+void
+index_hist (const char * hist, size_t len, uint32_t seq)
+{
+	uint32_t k = NEXT_GRAM(GRAM_ANCHOR, GRAM_ANCHOR);
+	size_t i;
+
+	for(i = 0; i < len; i++){
+		k = NEXT_GRAM(k, hist[i]);
+		gram_list *l = find_gram(k + 1, 1);
+		if(l -> len > l -> start && l -> seqs[l -> len - 1] == seq)
+			continue;	/* the trigram occurs twice in the entry */
+		if(l -> len == l -> cap){
+			l -> cap = l -> cap ? l -> cap * 2 : 4;
+			l -> seqs = erealloc(l -> seqs, sizeof(uint32_t) * l -> cap);
+		}
+		l -> seqs[l -> len++] = seq;
+	}
+}
+
+
+/* Remove the oldest entry hist, whose sequence number is seq, from the search index. */
+static
+void
+unindex_hist (const char * hist, size_t len, uint32_t seq)
+{
+	uint32_t k = NEXT_GRAM(GRAM_ANCHOR, GRAM_ANCHOR);
+	size_t i;
+
+	for(i = 0; i < len; i++){
+		k = NEXT_GRAM(k, hist[i]);
+		gram_list *l = find_gram(k + 1, 0);
+		if(l == NULL || l -> start == l -> len || l -> seqs[l -> start] != seq)
+			continue;
+		if(++(l -> start) == l -> len){
+			l -> start = l -> len = 0;
+		}else if(l -> start >= 16 && l -> start * 2 >= l -> len){
+			memmove(l -> seqs, &(l -> seqs)[l -> start], sizeof(uint32_t) * (l -> len - l -> start));
+			l -> len -= l -> start;
+			l -> start = 0;
+		}
+	}
+}
+
+
+/* Empty the search index, keeping the memory of the lists. */
+static
+void
+clear_index (void)
+{
+	size_t i;
+
+	for(i = 0; i < gram_table_size; i++)
+		gram_table[i].start = gram_table[i].len = 0;
+}
+
+
+/* Add d to the slot p of the Fenwick tree. */
+static
+void
+live_add (size_t p, int d)
+{
+	for(p++; p <= hist_slots; p += p & -p)
+		live_tree[p] += d;
+}
+
+
+/* Return the number of live slots before the slot p. */
+static
+size_t
+live_sum (size_t p)
+{
+	size_t n = 0;
+
+	for(; p > 0; p -= p & -p)
+		n += live_tree[p];
+	return n;
+}
+
+
+/* Return the slot of the k-th live slot (k >= 1). */
+static
+size_t
+live_find (size_t k)
+{
+	size_t p = 0, step = 1;
+
+	while(step * 2 <= hist_slots)
+		step *= 2;
+	for(; step > 0; step /= 2){
+		if(p + step <= hist_slots && (size_t) live_tree[p + step] < k){
+			p += step;
+			k -= live_tree[p];
+		}
+	}
+	return p;
+}
+
+
+/* Return the number of the live entry i (entry numbers start at 1). */
+static
+size_t
+hist_rank (size_t i)
+{
+	size_t p = (hist_first + i) % hist_slots;
+	size_t wrapped = live_sum(hist_first);	/* live slots before hist_first are newer */
+
+	if(p >= hist_first)
+		return live_sum(p + 1) - wrapped;
+	return (hist_live - wrapped) + live_sum(p + 1);
+}
+
+
+/* Return the entry i of the entry number n. */
+static
+size_t
+hist_select (size_t n)
+{
+	size_t wrapped = live_sum(hist_first);
+	size_t p;
+
+	if(n <= hist_live - wrapped)
+		p = live_find(wrapped + n);
+	else
+		p = live_find(n - (hist_live - wrapped));
+	return (p + hist_slots - hist_first) % hist_slots;
+}
+
+
+#define DUP_SLOT(hash)	(((hash) * 0x9e3779b1U) & (dup_table_size - 1))
+
+/* Add the entry with the sequence number seq and the hash hash to the hash set. */
+static
+void
+dup_insert (uint32_t hash, uint32_t seq)
+{
+	size_t i;
+
+	if(!(hist_control & HC_ERASEDUPS))
+		return;
+
+	if((dup_used + 1) * 4 > dup_table_size * 3){
+		dup_slot *old = dup_table;
+		size_t old_size = dup_table_size;
+		dup_table_size = DUP_TABLE_MIN;
+		while(dup_table_size * 3 < (hist_live + 1) * 4 * 2)
+			dup_table_size *= 2;
+		dup_table = emalloc(sizeof(dup_slot) * dup_table_size);
+		memset(dup_table, 0xff, sizeof(dup_slot) * dup_table_size);
+		dup_used = 0;
+		for(i = 0; i < old_size; i++)
+			if(old[i].seq != DUP_EMPTY && old[i].seq != DUP_DELETED)
+				dup_insert(old[i].hash, old[i].seq);
+		free(old);
+	}
+
+	for(i = DUP_SLOT(hash); dup_table[i].seq != DUP_EMPTY && dup_table[i].seq != DUP_DELETED; 
+	    i = (i + 1) & (dup_table_size - 1))
+		;
+	if(dup_table[i].seq == DUP_EMPTY)
+		dup_used++;
+	dup_table[i].hash = hash;
+	dup_table[i].seq = seq;
+}
+
+
+static
+void
+dup_remove (uint32_t hash, uint32_t seq)
+{
+	size_t i;
+
+	if(!(hist_control & HC_ERASEDUPS))
+		return;
+	for(i = DUP_SLOT(hash); dup_table[i].seq != DUP_EMPTY; i = (i + 1) & (dup_table_size - 1)){
+		if(dup_table[i].seq == seq){
+			dup_table[i].seq = DUP_DELETED;
+			return;
+		}
+	}
+}
+
+
+/* Make the entry i a tombstone. */
+static
+void
+erase_hist (size_t i)
+{
+	hist_entry *e = ENTRY(i);
+
+	e -> erased = 1;
+	live_add((hist_first + i) % hist_slots, -1);
+	dup_remove(e -> hash, hist_seq + i);
+	hist_live--;
+}
+
+
+/* Drop the oldest entry of the history list. */
+static
+void
+drop_hist (void)
+{
+	hist_entry *e = ENTRY(0);
+
+	if(!e -> erased)
+		erase_hist(0);
+	unindex_hist(&hist_ring[e -> off], e -> len, hist_seq);
+	hist_seq++;
+	hist_first = (hist_first + 1) % hist_slots;
+	hist_count--;
+}
+
+
+/* Copy the live entries into new rings with room for at least want entries, twice 
+ * the live ones, and at least ring_len bytes, dropping the oldest entries that do not 
+ * fit in size. The entries are numbered again from hist_seq, so the search index and 
+ * the hash set are rebuilt.
+ */
+static
+void
+rebuild_hist (size_t size, size_t want, size_t ring_len)
+{
+	size_t room, slots;
+	size_t i, n, bytes = 0;
+
+	while(hist_live > size)
+		drop_hist();
+	room = (hist_live * 2 > HIST_RING_MIN) ? hist_live * 2 : HIST_RING_MIN;
+	if(room < want)
+		room = want;
+	if(room > size)
+		room = size;
+	slots = room * 2;
+	for(i = 0; i < hist_count; i++)
+		if(!ENTRY(i) -> erased)
+			bytes += ENTRY(i) -> len + 1;
+	if(ring_len < bytes + 1)
+		ring_len = bytes + 1;
+
+	char *ring = emalloc(ring_len);
+	hist_entry *entries = emalloc(sizeof(hist_entry) * (slots ? slots : 1));
+	size_t tail = 0;
+	for(i = 0, n = 0; i < hist_count; i++){
+		hist_entry *e = ENTRY(i);
+		if(e -> erased)
+			continue;
+		memcpy(&ring[tail], &hist_ring[e -> off], e -> len + 1);
+		entries[n] = *e;
+		entries[n++].off = tail;
+		tail += e -> len + 1;
+	}
+
+	free(hist_ring);
+	free(hist_entries);
+	hist_ring = ring;
+	hist_ring_len = ring_len;
+	ring_tail = tail;
+	hist_entries = entries;
+	hist_size = size;
+	hist_slots = slots;
+	hist_first = 0;
+	hist_count = hist_live = n;
+
+	free(live_tree);
+	live_tree = emalloc(sizeof(int) * (slots + 1));
+	memset(live_tree, 0, sizeof(int) * (slots + 1));
+	for(i = 1; i <= n; i++)
+		live_tree[i]++;
+	for(i = 1; i <= slots; i++)
+		if(i + (i & -i) <= slots)
+			live_tree[i + (i & -i)] += live_tree[i];
+
+	clear_index();
+	if(dup_table != NULL)
+		memset(dup_table, 0xff, sizeof(dup_slot) * dup_table_size);
+	dup_used = 0;
+	for(i = 0; i < n; i++){
+		index_hist(&ring[entries[i].off], entries[i].len, hist_seq + i);
+		dup_insert(entries[i].hash, hist_seq + i);
+	}
+}
+
+
+/* Return the offset in hist_ring for n more bytes, or -1 if they do not fit. */
+static
+long
+ring_space (size_t n)
+{
+	if(hist_count == 0)
+		return (n < hist_ring_len) ? 0 : -1;
+
+	size_t head = ENTRY(0) -> off;
+	if(ring_tail > head){	/* the used bytes do not wrap */
+		if(ring_tail + n <= hist_ring_len)
+			return ring_tail;
+		return (n < head) ? 0 : -1;
+	}
+	return (ring_tail + n < head) ? (long) ring_tail : -1;
+}
 
-#define HIST_SIZE 500
 
-static char * hist_list[HIST_SIZE];		/* history list */
-static int    hist_pos     = 0;
-static int    hist_is_full = 0;
+/* Append the len bytes of hist to the history list, applying HISTCONTROL. 
+ * Return 0 if the entry is ignored, 1 if it is added.
+ */
+static
+int
+push_hist (const char * hist, size_t len)
+{
+	uint32_t hash = (uint32_t) hash_bytes(hist, len);
+	long off;
+	size_t i;
+
+	if(hist_size == 0)
+		return 0;	/* history is off */
+	if(hist_entries == NULL)
+		rebuild_hist(hist_size, 0, ((hist_size < HIST_RING_MIN) ? hist_size : HIST_RING_MIN) * HIST_ENTRY_AVG);
+
+	if((hist_control & HC_IGNOREDUPS) && hist_live > 0){
+		hist_entry *e = ENTRY(hist_select(hist_live));
+		if(e -> hash == hash && e -> len == len && memcmp(&hist_ring[e -> off], hist, len) == 0)
+			return 0;
+	}
+	if((hist_control & HC_ERASEDUPS) && dup_table != NULL){
+		for(i = DUP_SLOT(hash); dup_table[i].seq != DUP_EMPTY; i = (i + 1) & (dup_table_size - 1)){
+			if(dup_table[i].seq == DUP_DELETED || dup_table[i].hash != hash)
+				continue;
+			size_t k = dup_table[i].seq - hist_seq;
+			hist_entry *e = ENTRY(k);
+			if(e -> len == len && memcmp(&hist_ring[e -> off], hist, len) == 0)
+				erase_hist(k);
+		}
+	}
+
+	while(hist_live >= hist_size)
+		drop_hist();
+	if(hist_count == hist_slots)	/* compact the tombstones, or grow */
+		rebuild_hist(hist_size, 0, hist_ring_len);
+	if((off = ring_space(len + 1)) == -1){
+		rebuild_hist(hist_size, 0, (hist_ring_len + len + 1) * 2);
+		off = ring_tail;
+	}
+
+	memcpy(&hist_ring[off], hist, len);
+	hist_ring[off + len] = '\0';
+	ring_tail = off + len + 1;
+
+	size_t p = (hist_first + hist_count) % hist_slots;
+	hist_entry *e = &hist_entries[p];
+	e -> off = off;
+	e -> len = len;
+	e -> hash = hash;
+	e -> erased = 0;
+	live_add(p, 1);
+	index_hist(hist, len, hist_seq + hist_count);
+	dup_insert(hash, hist_seq + hist_count);
+	hist_count++;
+	hist_live++;
+	return 1;
+}
+
+
+/* Return the header of the record at offset off of the n bytes buf, or NULL if it 
+ * is not valid or not complete.
+ */
+static
+const hist_head *
+record_at (const char * buf, size_t n, size_t off)
+{
+	const hist_head *h = (const hist_head *) &buf[off];
+
+	if(off % 8 != 0 || off + sizeof(hist_head) > n || h -> magic != HIST_MAGIC)
+		return NULL;
+	if(RECORD_SIZE(h -> len) > n - off)
+		return NULL;
+	return h;
+}
+
+
+/* Read the last records of the history file into the history list, before the 
+ * entries that were added in this session.
+ */
+static
+void
+load_hist (void)
+{
+	size_t room = hist_size - hist_live;
+	size_t nfile = 0;
+
+	hist_loaded = 1;
+	if(hist_map == NULL)
+		return;
+	if(room > hist_map_len / RECORD_SIZE(0))
+		room = hist_map_len / RECORD_SIZE(0);
+
+	/* Walk the trailers backwards: offs[] gets the newest record first. */
+	size_t *offs = emalloc(sizeof(size_t) * (room ? room : 1));
+	size_t end = hist_map_len;
+	while(end > 0 && nfile < room){
+		const hist_tail *t = (const hist_tail *) &hist_map[end - sizeof(hist_tail)];
+		const hist_head *h;
+		if(end < sizeof(hist_tail) || t -> magic != HIST_MAGIC || t -> size > end
+		   || (h = record_at(hist_map, hist_map_len, end - t -> size)) == NULL || RECORD_SIZE(h -> len) != t -> size)
+			break;
+		end -= t -> size;
+		offs[nfile++] = end;
+	}
+
+	if(end > 0 && nfile < room){
+		/* The tail of the file is damaged: scan forward from the start, keeping the 
+		 * offsets of the last valid records in a ring.
+		 */
+		size_t *ring = emalloc(sizeof(size_t) * room);
+		size_t off = 0, n = 0, i;
+		const hist_head *h;
+		while((h = record_at(hist_map, hist_map_len, off)) != NULL){
+			ring[n++ % room] = off;
+			off += RECORD_SIZE(h -> len);
+		}
+		nfile = (n < room) ? n : room;
+		for(i = 0; i < nfile; i++)	/* put the newest record first, as above */
+			offs[i] = ring[(n - 1 - i) % room];
+		free(ring);
+	}
+
+	/* Put the session entries back after the file entries. */
+	if(nfile > 0){
+		size_t nsession, i, bytes;
+		rebuild_hist(hist_size, 0, hist_ring_len);	/* compact the session entries */
+		char *session = hist_ring;
+		hist_entry *session_index = hist_entries;
+		nsession = hist_count;
+		bytes = ring_tail;
+		for(i = 0; i < nfile; i++)
+			bytes += ((const hist_head *) &hist_map[offs[i]]) -> len + 1;
+		hist_ring = NULL;
+		hist_entries = NULL;
+		hist_first = hist_count = hist_live = 0;
+		rebuild_hist(hist_size, nfile + nsession, bytes + bytes / 4 + 1);	/* so that the rings need not grow */
+
+		for(i = nfile; i > 0; i--){
+			const hist_head *h = (const hist_head *) &hist_map[offs[i - 1]];
+			push_hist((const char *) (h + 1), h -> len);
+		}
+		for(i = 0; i < nsession; i++)
+			push_hist(&session[session_index[i].off], session_index[i].len);
+		free(session);
+		free(session_index);
+	}
+
+	free(offs);
+	munmap(hist_map, hist_map_len);
+	hist_map = NULL;
+}
+
+
+/* Read the records that were appended to the history file since hist_sync_off into 
+ * the history list (HISTSHARE).
+ */
+static
+void
+sync_hist (void)
+{
+	struct stat st;
+	size_t n, off = 0, got = 0;
+	const hist_head *h;
+
+	if(!hist_shared || hist_fd == -1 || fstat(hist_fd, &st) == -1 || st.st_size <= hist_sync_off)
+		return;
+
+	n = st.st_size - hist_sync_off;
+	char *buf = emalloc(n);
+	while(got < n){
+		ssize_t rv = pread(hist_fd, buf + got, n - got, hist_sync_off + got);
+		if(rv == -1 && errno == EINTR)
+			continue;
+		if(rv <= 0)
+			break;
+		got += rv;
+	}
+
+	while(off < got){
+		if((h = record_at(buf, got, off)) != NULL){
+			push_hist((const char *) (h + 1), h -> len);
+			off += RECORD_SIZE(h -> len);
+		}else if(off + sizeof(hist_head) <= got && ((const hist_head *) &buf[off]) -> magic == HIST_MAGIC 
+		         && RECORD_SIZE(((const hist_head *) &buf[off]) -> len) > got - off){
+			break;		/* not complete yet, read it the next time */
+		}else{
+			off += 8;	/* damaged, look for the next record */
+		}
+	}
+	hist_sync_off += off;
+
+	free(buf);
+}
+
+
+/* Make the history list ready for use. */
+static
+void
+use_hist (void)
+{
+	if(!hist_loaded)
+		load_hist();
+	sync_hist();
+}
+
+
+/* Use the history file path. Its records are read when the history is first used. 
+ * Return 0 if success, -1 if failed.
+ */
+int
+init_hist (char * path)
+{
+	struct stat st;
+
+	if((hist_fd = open(path, O_RDWR | O_CREAT | O_APPEND | O_CLOEXEC, S_IRUSR | S_IWUSR)) == -1){
+		fprintf(stderr, "history: %s: %s\n", path, strerror(errno));
+		return -1;
+	}
+
+	if(fstat(hist_fd, &st) == 0 && st.st_size > 0){
+		hist_sync_off = st.st_size;
+		void *map = mmap(NULL, st.st_size, PROT_READ, MAP_PRIVATE, hist_fd, 0);
+		if(map != MAP_FAILED){
+			hist_map = map;
+			hist_map_len = st.st_size;
+			hist_loaded = 0;
+		}
+	}
+
+	return 0;
+}
+
+
+/* Change the number of entries in the history list (HISTSIZE). value is the new 
+ * size, or NULL for the default size.
+ */
+void
+set_hist_size (const char * value)
+{
+	char *end;
+	long size = HIST_SIZE;
+
+	if(value != NULL && *value != '\0'){
+		size = strtol(value, &end, 10);
+		if(*end != '\0' || size < 0)
+			size = HIST_SIZE;
+	}
+	if((size_t) size == hist_size)
+		return;
+
+	if(hist_entries == NULL)
+		hist_size = size;
+	else
+		rebuild_hist(size, 0, hist_ring_len);
+}
+
+
+/* Share the history file with the other sessions if value is not empty (HISTSHARE). 
+ * The entries of the other sessions are read from the time it is switched on.
+ */
+void
+set_hist_share (const char * value)
+{
+	int shared = (value != NULL && *value != '\0');
+
+	if(shared && !hist_shared && hist_fd != -1){
+		off_t end = lseek(hist_fd, 0, SEEK_END);
+		if(end != -1)
+			hist_sync_off = end;
+	}
+	hist_shared = shared;
+}
+
+
+/* Change the way entries are added (HISTCONTROL), a list of "ignoredups", 
+ * "erasedups" or "ignoreboth" separated by colons. value is NULL if unset.
+ */
+void
+set_hist_control (const char * value)
+{
+	const char *p = value, *end;
+	int old_control = hist_control;
+	size_t i;
+
+	hist_control = 0;
+	while(p != NULL && *p != '\0'){
+		if((end = strchr(p, ':')) == NULL)
+			end = p + strlen(p);
+		if((end - p == 10 && strncmp(p, "ignoredups", 10) == 0) 
+		   || (end - p == 10 && strncmp(p, "ignoreboth", 10) == 0))
+			hist_control |= HC_IGNOREDUPS;
+		else if(end - p == 9 && strncmp(p, "erasedups", 9) == 0)
+			hist_control |= HC_ERASEDUPS;
+		p = (*end == ':') ? end + 1 : end;
+	}
+
+	/* The hash set is only kept for HC_ERASEDUPS. */
+	if((hist_control ^ old_control) & HC_ERASEDUPS){
+		free(dup_table);
+		dup_table = NULL;
+		dup_table_size = dup_used = 0;
+		for(i = 0; i < hist_count; i++)
+			if(!ENTRY(i) -> erased)
+				dup_insert(ENTRY(i) -> hash, hist_seq + i);
+	}
+}
 
 
 char *
 get_hist (int hist_index)
 {
-	if(hist_is_full){
-		if(hist_index < 1 || hist_index > HIST_SIZE)
-			return (char *) -1;
-		return hist_list[(hist_pos+hist_index-1)%HIST_SIZE];
-	}else{
-		if(hist_pos == 0)
-			return (char *) -1;
-		if(hist_index < 1 || hist_index > hist_pos)
-			return (char *) -1;
-		return hist_list[hist_index-1];
+	use_hist();
+
+	if(hist_index < 1 || (size_t) hist_index > hist_live)
+		return (char *) -1;
+	return &hist_ring[ENTRY(hist_select(hist_index)) -> off];
+}
+
+
+/* Return the number of entries in the history list. */
+int
+count_hist (void)
+{
+	use_hist();
+	return hist_live;
+}
+
+
+/* Return the offset of the len bytes s in the n bytes p, or -1 if they are not there. */
+static
+long
+find_bytes (const char * p, size_t n, const char * s, size_t len)
+{
+	const char *q = p, *end = p + n;
+
+	if(len == 0)
+		return 0;
+	while((size_t) (end - q) >= len && (q = memchr(q, s[0], end - q - len + 1)) != NULL){
+		if(memcmp(q, s, len) == 0)
+			return q - p;
+		q++;
 	}
+	return -1;
 }
 
 
+static
+int
+hist_matches (const hist_entry * e, const char * s, size_t len, int prefix)
+{
+	const char *text = &hist_ring[e -> off];
+
+	if(e -> erased)
+		return 0;
+	if(prefix)
+		return e -> len >= len && memcmp(text, s, len) == 0;
+	return find_bytes(text, e -> len, s, len) != -1;
+}
+
+
+/* Return the number of the newest entry before the entry number before that starts 
+ * with (prefix is true) or contains the len bytes s, or 0 if there is none. Every 
+ * entry is searched if before is 0. The candidates come from the list of the rarest 
+ * trigram of s; substrings shorter than a trigram are searched by a scan.
+ */
+int
+search_hist (const char * s, size_t len, int prefix, int before)
+{
+	gram_list *best = NULL;
+	size_t best_end = 0, best_n = 0;
+	size_t i;
+
+	use_hist();
+
+	if(hist_live == 0)
+		return 0;
+	if(before < 1 || (size_t) before > hist_live)
+		i = hist_count;
+	else
+		i = hist_select(before);
+	uint32_t limit = hist_seq + i;	/* search the sequence numbers below limit */
+
+	if((prefix && len > 0) || len >= 3){
+		uint32_t k = prefix ? NEXT_GRAM(GRAM_ANCHOR, GRAM_ANCHOR) : 0;
+		for(i = 0; i < len; i++){
+			k = NEXT_GRAM(k, s[i]);
+			if(!prefix && i < 2)
+				continue;
+
+			gram_list *l = find_gram(k + 1, 0);
+			if(l == NULL || l -> start == l -> len)
+				return 0;
+			size_t lo = l -> start, hi = l -> len;	/* find the first seqs[] >= limit */
+			while(lo < hi){
+				size_t mid = lo + (hi - lo) / 2;
+				if(l -> seqs[mid] < limit)
+					lo = mid + 1;
+				else
+					hi = mid;
+			}
+			if(best == NULL || lo - l -> start < best_n){
+				best = l;
+				best_end = lo;
+				best_n = lo - l -> start;
+			}
+		}
+
+		for(i = best_end; i > best -> start; i--){
+			size_t n = best -> seqs[i - 1] - hist_seq;
+			if(hist_matches(ENTRY(n), s, len, prefix))
+				return hist_rank(n);
+		}
+		return 0;
+	}
+
+	for(i = limit - hist_seq; i > 0; i--)
+		if(hist_matches(ENTRY(i - 1), s, len, prefix))
+			return hist_rank(i - 1);
+	return 0;
+}
+
+
+/* Append hist to the history file with a single write(). */
+static
 void
-add_hist (char * hist)
+write_hist (const char * hist, size_t len)
 {
-	if(hist_is_full){
-		free(hist_list[hist_pos]);
-		hist_list[hist_pos++] = hist;
-		if(hist_pos >= HIST_SIZE)
-			hist_pos = 0;
-	}else{
-		hist_list[hist_pos++] = hist;
-		if(hist_pos >= HIST_SIZE){
-			hist_is_full = 1;
-			hist_pos = 0;
+	size_t size = RECORD_SIZE(len);
+	char stack_buf[BUFSIZ];
+	char *buf = (size <= sizeof(stack_buf)) ? stack_buf : emalloc(size);
+
+	hist_head h = { HIST_MAGIC, (uint32_t) len, (int64_t) time(NULL) };
+	hist_tail t = { (uint32_t) size, HIST_MAGIC };
+	memset(buf, 0, size);
+	memcpy(buf, &h, sizeof(h));
+	memcpy(buf + sizeof(h), hist, len);
+	memcpy(buf + size - sizeof(t), &t, sizeof(t));
+
+	if(write(hist_fd, buf, size) != (ssize_t) size)
+		perror("history");
+
+	if(buf != stack_buf)
+		free(buf);
+}
+
+
+/* Add a copy of hist to the history list. */
+void
+add_hist (const char * hist)
+{
+	size_t len = strlen(hist);
+
+	if(hist_size == 0)	/* history is off, so nothing goes to the file either */
+		return;
+	if(hist_shared && hist_fd != -1){	/* sync_hist() reads it back from the file */
+		write_hist(hist, len);
+		return;
+	}
+	if(!hist_loaded && hist_control != 0)	/* the duplicates may be in the file */
+		load_hist();
+	if(push_hist(hist, len) && hist_fd != -1)
+		write_hist(hist, len);
+}
+
+
+/* Write the n bytes at buf to the standard output. */
+static
+int
+write_all (const char * buf, size_t n)
+{
+	while(n > 0){
+		ssize_t rv = write(STDOUT_FILENO, buf, n);
+		if(rv == -1){
+			if(errno == EINTR)
+				continue;
+			return -1;
 		}
+		buf += rv;
+		n -= rv;
 	}
+	return 0;
 }
 
 
+/* Print the history list as "%3d  %s\n" lines, formatted into a large buffer 
+ * that is written with few write() calls.
+ */
 void
 print_hist_list (void)
 {
-	int pos = hist_pos;
-	int index = 1;
-	if(hist_is_full){
-		while(index <= HIST_SIZE){
-			printf("%3d  %s\n", index++, hist_list[pos++]);
-			if(pos >= HIST_SIZE)
-				pos = 0;
+	char *buf = emalloc(HIST_OUT_BUF);
+	size_t pos = 0;
+	size_t i, number = 0;
+
+	use_hist();
+
+	fflush(stdout);
+	for(i = 0; i < hist_count; i++){
+		hist_entry *e = ENTRY(i);
+		char num[24];
+		int k = sizeof(num);
+		size_t n = ++number;
+
+		if(e -> erased){
+			number--;
+			continue;
 		}
-	}else{
-		pos = 0;
-		while(pos != hist_pos)
-			printf("%3d  %s\n", index++, hist_list[pos++]);
+		do{
+			num[--k] = '0' + n % 10;
+			n /= 10;
+		}while(n > 0);
+		while(k > (int) sizeof(num) - 3)
+			num[--k] = ' ';
+
+		size_t line_len = (sizeof(num) - k) + 2 + e -> len + 1;
+		if(pos + line_len > HIST_OUT_BUF){
+			if(write_all(buf, pos) == -1)
+				break;
+			pos = 0;
+		}
+		if(line_len > HIST_OUT_BUF){	/* an entry longer than the buffer */
+			if(write_all(&num[k], sizeof(num) - k) == -1 || write_all("  ", 2) == -1
+			   || write_all(&hist_ring[e -> off], e -> len) == -1 || write_all("\n", 1) == -1)
+				break;
+			continue;
+		}
+		memcpy(&buf[pos], &num[k], sizeof(num) - k);
+		pos += sizeof(num) - k;
+		buf[pos++] = ' ';
+		buf[pos++] = ' ';
+		memcpy(&buf[pos], &hist_ring[e -> off], e -> len);
+		pos += e -> len;
+		buf[pos++] = '\n';
 	}
+	if(i == hist_count && pos > 0)
+		write_all(buf, pos);
+
+	free(buf);
 }
 
 
-/* $end historylib.c */
\ No newline at end of file
+/* $end historylib.c */
@@ -6,8 +6,16 @@
 #define __HISTORYLIB_H__
 
 
+#include <stddef.h>
+
+extern int init_hist (char * path);
+extern void set_hist_size (const char * value);
+extern void set_hist_control (const char * value);
+extern void set_hist_share (const char * value);
 extern char * get_hist (int hist_index);
-extern void add_hist (char * hist);
+extern int count_hist (void);
+extern int search_hist (const char * s, size_t len, int prefix, int before);
+extern void add_hist (const char * hist);
 extern void print_hist_list (void);
 
 
@@ -2,26 +2,94 @@
  * job_control.c
  */
 /* $begin job_control.c */
-#define _POSIX_C_SOURCE 1	/* for kill(), see the man pages KILL(2) and FEATURE_TEST_MACROS(7) */
+#define _GNU_SOURCE	/* for kill(), posix_spawn_file_actions_addtcsetpgrp_np(), pipe2(), splice() 
+					 * and F_SETPIPE_SZ, see FEATURE_TEST_MACROS(7) */
 
 #include <stdio.h>
 #include <stdlib.h>
+#include <string.h>
 #include <sys/types.h>
 #include <sys/wait.h>
 #include <sys/stat.h>
+#include <sys/mman.h>
+#include <sys/signalfd.h>
 #include <fcntl.h>
+#include <poll.h>
+#include <time.h>
 #include <unistd.h>
 #include <signal.h>
 #include <termios.h>
 #include <errno.h>
+#include <limits.h>
+#include <spawn.h>
 #include "myshell.h"
+#include "variablelib.h"
+#include "pathlib.h"
+#include "tracelib.h"
+
+extern char **environ;
 
 
 /* The active jobs are linked into a list. This is its head. */
 job *first_job = NULL;
+static job *last_job = NULL;
 
 job *current_job = NULL;
-pid_t job_id = 1;
+
+/* job_slots[jid] is the active job with that jid, or NULL. The jids of removed jobs 
+ * are kept on a free list (a stack) and given to new jobs first.
+ */
+static job **job_slots = NULL;
+static size_t slots_size = 0;
+static pid_t next_jid = 1;		/* the lowest jid that has never been used */
+static pid_t *free_jids = NULL;
+static size_t free_count = 0;
+static size_t free_size = 0;
+
+/* Every process that has been started and not yet reaped is indexed by its pid in an 
+ * open-addressing hash table (linear probing), so a waitpid() result is found in O(1).
+ */
+typedef struct pid_slot
+{
+	pid_t pid;					/* PID_EMPTY, PID_DELETED or the pid of p */
+	process *p;
+	job *j;
+} pid_slot;
+
+#define PID_EMPTY		0
+#define PID_DELETED		(-1)
+#define PID_TABLE_MIN	64		/* a power of 2 */
+
+static pid_slot *pid_table = NULL;
+static size_t pid_table_size = 0;
+static size_t pid_table_used = 0;	/* slots that are not empty, including deleted ones */
+static size_t pid_count = 0;
+
+/* The jobs that do_job_notification() has to look at are linked through next_changed. */
+static job *first_changed = NULL;
+
+/* SIGCHLD is blocked and read from this signalfd, so children are only reaped when one 
+ * of them has changed state. next_cmd() watches it together with the input.
+ */
+static int sigchld_fd = -1;
+static sigset_t sigchld_set;
+
+/* At most max_jobs background jobs run at a time (MAXJOBS, 0 for no limit). Further 
+ * background jobs wait in a FIFO queue that update_status() starts them from, or the 
+ * shell blocks until a slot is free (MAXJOBS_POLICY=block). Stopped jobs cannot free 
+ * their slots, so the shell queues the job instead of blocking on them.
+ */
+static long max_jobs = 0;
+static int max_jobs_block = 0;
+static long slots_used = 0;
+static job *first_queued = NULL;
+static job *last_queued = NULL;
+static long queued_count = 0;
+
+/* Report the jobs that change state as soon as it happens (set -b), 
+ * not only before the next prompt.
+ */
+static int notify_now = 0;
 
 /* Keep track of attributes of the shell. */
 static pid_t shell_pgid;
@@ -29,6 +97,223 @@ struct termios shell_tmodes;
 static int shell_terminal;
 
 int foreground = 1;
+int shell_is_interactive;
+
+/* Exit status of the last foreground job or builtin command ($?). */
+int last_status = 0;
+
+/* Processes are started with posix_spawn() instead of fork() if this is true (LAUNCHMODE). 
+ * A foreground process of an interactive shell can only be spawned if the child can 
+ * take the terminal, which needs glibc 2.35.
+ */
+static int launch_spawn = 0;
+
+/* Pipes are created with this capacity (PIPESIZE), or with the default one if it is 0. */
+static int pipe_size = 0;
+static int pipe_size_failed = 0;	/* F_SETPIPE_SZ was refused for pipe_size, so it is not retried */
+
+/* Every pipe of a job is split in two by a relay process that counts the traffic (PIPESTATS). */
+static int pipe_stats_on = 0;
+
+#if defined(__GLIBC__) && (__GLIBC__ > 2 || (__GLIBC__ == 2 && __GLIBC_MINOR__ >= 35))
+#define HAVE_SPAWN_TCSETPGRP
+#endif
+
+
+static
+size_t
+pid_hash (pid_t pid)
+{
+	return (size_t) pid * 2654435761u;
+}
+
+
+static
+pid_slot *
+lookup_pid (pid_t pid)
+{
+	size_t mask = pid_table_size - 1;
+	size_t i;
+
+	if(pid_table_size == 0)
+		return NULL;
+
+	for(i = pid_hash(pid) & mask; pid_table[i].pid != PID_EMPTY; i = (i + 1) & mask)
+		if(pid_table[i].pid == pid)
+			return &pid_table[i];
+	return NULL;
+}
+
+
+/* Put the started process p of job j into the pid index. */
+static
+void
+index_pid (job * j, process * p)
+{
+	size_t mask, i;
+
+	if((pid_table_used + 1) * 2 > pid_table_size){
+		/* rebuild with room for twice the live entries, dropping deleted slots */
+		pid_slot *old = pid_table;
+		size_t old_size = pid_table_size;
+		size_t new_size = PID_TABLE_MIN;
+		while(new_size < (pid_count + 1) * 4)
+			new_size *= 2;
+
+		pid_table = emalloc(sizeof(pid_slot) * new_size);
+		memset(pid_table, 0, sizeof(pid_slot) * new_size);
+		pid_table_size = new_size;
+		pid_table_used = pid_count;
+		mask = new_size - 1;
+		for(i = 0; i < old_size; i++){
+			if(old[i].pid == PID_EMPTY || old[i].pid == PID_DELETED)
+				continue;
+			size_t k = pid_hash(old[i].pid) & mask;
+			while(pid_table[k].pid != PID_EMPTY)
+				k = (k + 1) & mask;
+			pid_table[k] = old[i];
+		}
+		free(old);
+	}
+
+	mask = pid_table_size - 1;
+	for(i = pid_hash(p->pid) & mask; pid_table[i].pid > 0; i = (i + 1) & mask)
+		;
+	if(pid_table[i].pid == PID_EMPTY)
+		pid_table_used++;
+	pid_table[i].pid = p->pid;
+	pid_table[i].p = p;
+	pid_table[i].j = j;
+	pid_count++;
+}
+
+
+static
+void
+unindex_pid (pid_t pid)
+{
+	pid_slot *slot = lookup_pid(pid);
+
+	if(slot != NULL){
+		slot->pid = PID_DELETED;
+		pid_count--;
+	}
+}
+
+
+/* Put job j on the list of jobs that do_job_notification() looks at. 
+ * Jobs that are not on the job list (jid 0, see start_job()) are left to their owner.
+ */
+static
+void
+job_changed (job * j)
+{
+	if(j->changed || j->jid == 0)
+		return;
+	j->changed = 1;
+	j->prev_changed = NULL;
+	j->next_changed = first_changed;
+	if(first_changed)
+		first_changed->prev_changed = j;
+	first_changed = j;
+}
+
+
+static
+void
+job_unchanged (job * j)
+{
+	if(!j->changed)
+		return;
+	j->changed = 0;
+	if(j->prev_changed)
+		j->prev_changed->next_changed = j->next_changed;
+	else
+		first_changed = j->next_changed;
+	if(j->next_changed)
+		j->next_changed->prev_changed = j->prev_changed;
+}
+
+
+/* The last finished background jobs, with the times of their processes (jobs -v). */
+#define MAX_FINISHED	16
+
+static job *finished_jobs[MAX_FINISHED];
+static int finished_next = 0;		/* the oldest entry, replaced next */
+
+
+/* Give the new job j a jid and append it to the list of active jobs. */
+void
+insert_job (job * j)
+{
+	pid_t jid;
+
+	if(free_count > 0){
+		jid = free_jids[--free_count];
+	}else{
+		jid = next_jid++;
+		if((size_t) jid >= slots_size){
+			size_t old_size = slots_size;
+			slots_size = slots_size ? slots_size * 2 : 64;
+			job_slots = erealloc(job_slots, sizeof(job *) * slots_size);
+			memset(&job_slots[old_size], 0, sizeof(job *) * (slots_size - old_size));
+		}
+	}
+	j->jid = jid;
+	job_slots[jid] = j;
+
+	j->changed = 0;
+	j->in_slot = 0;
+	j->queued = 0;
+	j->started = 0;
+	j->next = NULL;
+	j->prev = last_job;
+	if(last_job)
+		last_job->next = j;
+	else
+		first_job = j;
+	last_job = j;
+}
+
+
+/* Delete the job j from the list of active jobs, release its jid and free it. */
+void
+remove_job (job * j)
+{
+	process *p;
+
+	if(j->prev)
+		j->prev->next = j->next;
+	else
+		first_job = j->next;
+	if(j->next)
+		j->next->prev = j->prev;
+	else
+		last_job = j->prev;
+
+	job_slots[j->jid] = NULL;
+	if(free_count == free_size){
+		free_size = free_size ? free_size * 2 : 64;
+		free_jids = erealloc(free_jids, sizeof(pid_t) * free_size);
+	}
+	free_jids[free_count++] = j->jid;
+
+	for(p = j->first_process; p; p = p->next)
+		if(p->pid > 0 && !p->completed)
+			unindex_pid(p->pid);
+	if(j->in_slot)
+		slots_used--;
+	job_unchanged(j);
+
+	/* finished background jobs are kept for jobs -v */
+	if(j->background && job_is_completed(j)){
+		if(finished_jobs[finished_next] != NULL)
+			free_job(finished_jobs[finished_next]);
+		finished_jobs[finished_next] = j;
+		finished_next = (finished_next + 1) % MAX_FINISHED;
+	}else
+		free_job(j);
+}
 
 
 /* Find the active job with the indicated jid. */
@@ -37,16 +322,9 @@ find_job (pid_t jid)
 {
 	job *j;
 
-	for(j = first_job; j; j = j->next)
-	{
-		if(j == current_job)
-			continue;
-
-		if(j->jid == jid)
-			return j;
-	}
-
-	return NULL;
+	if(jid <= 0 || (size_t) jid >= slots_size || (j = job_slots[jid]) == NULL || j == current_job)
+		return NULL;
+	return j;
 }
 
 
@@ -63,37 +341,41 @@ mark_job_as_running (job * j)
 }
 
 
-/* Store the status of the process pid that was returned by waitpid.
+/* Store the status and resource usage ru of the process pid that was returned by wait4().
  * Return 0 if all went well, nonzero otherwise.
  */
 static
 int
-mark_process_status (pid_t pid, int status)
+mark_process_status (pid_t pid, int status, const struct rusage * ru)
 {
-	job *j;
+	pid_slot *slot;
 	process *p;
 
 
 	if(pid > 0){
 		/* Update the record for the process. */
-    	for(j = first_job; j; j = j->next)
-    	{
-        	for(p = j->first_process; p; p = p->next)
-        	{
-        		if(p->pid == pid){
-            		p->status = status;
-            		if(WIFSTOPPED(status)){
-            			p->stopped = 1;
-            		}else{
-                		p->completed = 1;
-                		if(WIFSIGNALED(status))
-                    		fprintf(stderr, "%d: Terminated by signal %d.\n",
-                            		(int) pid, WTERMSIG(p->status));
-                	}
-            		return 0;
-            	}
-            }
-    	}
+		if((slot = lookup_pid(pid)) != NULL){
+			p = slot->p;
+			p->status = status;
+			if(WIFSTOPPED(status)){
+				p->stopped = 1;
+			}else{
+				p->completed = 1;
+				p->ru = *ru;
+				clock_gettime(CLOCK_MONOTONIC, &p->end);
+				slot->pid = PID_DELETED;	/* the pid may be used again now */
+				pid_count--;
+				if(slot->j->in_slot && job_is_completed(slot->j)){
+					slot->j->in_slot = 0;
+					slots_used--;
+				}
+				if(WIFSIGNALED(status))
+					fprintf(stderr, "%d: Terminated by signal %d.\n",
+					        (int) pid, WTERMSIG(p->status));
+			}
+			job_changed(slot->j);
+			return 0;
+		}
     	fprintf(stderr, "No child process %d.\n", pid);
     	return -1;
     }else if(pid == 0 || errno == ECHILD){
@@ -107,6 +389,25 @@ mark_process_status (pid_t pid, int status)
 }
 
 
+/* Return the exit status of the stopped or completed job j, which is the status of 
+ * its last process; 128 plus the signal number if that was stopped or killed.
+ */
+int
+job_status (job * j)
+{
+	process *p = j->first_process;
+
+	while(p->next)
+		p = p->next;
+	if(p->stopped)
+		return 128 + WSTOPSIG(p->status);
+	else if(WIFSIGNALED(p->status))
+		return 128 + WTERMSIG(p->status);
+	else
+		return WEXITSTATUS(p->status);
+}
+
+
 /* Check for processes that have status information available,
  * blocking until all processes in the given job have reported.
  */
@@ -114,14 +415,58 @@ static
 void
 wait_for_job (job * j)
 {
+	struct rusage ru;
 	int status;
 	pid_t pid;
+	process *p;
+	long others = pid_count;
+	unsigned long long t;
 
-	do{
-		pid = waitpid(-1, &status, WUNTRACED);
-	}while(!mark_process_status(pid, status)
-		   && !job_is_stopped(j)
-		   && !job_is_completed(j));
+	for(p = j->first_process; p; p = p->next)
+		if(p->pid > 0 && !p->completed)
+			others--;
+
+	/* Only the processes of j are waited for if the shell has no other children. 
+	 * Otherwise all children are reaped as they finish, so that the queue of 
+	 * background jobs keeps moving and their end times are right.
+	 */
+	for(p = j->first_process; p; p = p->next){
+		TRACE_BEGIN(t);
+		while(!p->completed && !p->stopped){
+			if(first_queued != NULL || others > 0){
+				wait_for_child();
+				continue;
+			}
+			pid = wait4(p->pid, &status, WUNTRACED, &ru);
+			if(pid == -1 && errno == EINTR)
+				continue;
+			if(mark_process_status(pid, status, &ru) != 0)
+				break;
+		}
+		TRACE_END(t, "wait process", p->argv[0]);
+	}
+
+	last_status = job_status(j);
+}
+
+
+/* Send the job j a SIGCONT signal: to its process group, or to each of its processes 
+ * without job control, where they are in the process group of the shell.
+ */
+static
+void
+continue_signal (job * j)
+{
+	process *p;
+
+	if(shell_is_interactive){
+		if(kill(- j->pgid, SIGCONT) < 0)
+			perror("kill (SIGCONT)");
+		return;
+	}
+	for(p = j->first_process; p; p = p->next)
+		if(!p->completed && p->pid > 0 && kill(p->pid, SIGCONT) < 0)
+			perror("kill (SIGCONT)");
 }
 
 
@@ -133,27 +478,44 @@ static
 void
 put_job_in_foreground (job * j, int cont)
 {
+	unsigned long long t;
+
+	/* Without job control there is no terminal to hand over. */
+	if(!shell_is_interactive){
+		if(cont)
+			continue_signal(j);
+		TRACE_BEGIN(t);
+		wait_for_job(j);
+		TRACE_END(t, "wait", j->command);
+		return;
+	}
+
 	/* Put the job into the foreground. */
+	TRACE_BEGIN(t);
 	tcsetpgrp(shell_terminal, j->pgid);
 
 
 	/* Send the job a continue signal, if necessary. */
 	if(cont){
     	tcsetattr(shell_terminal, TCSADRAIN, &j->tmodes);
-    	if(kill(- j->pgid, SIGCONT) < 0)
-    		perror ("kill (SIGCONT)");
+    	continue_signal(j);
     }
+	TRACE_END(t, "terminal to job", NULL);
 
 
 	/* Wait for it to report. */
+	TRACE_BEGIN(t);
 	wait_for_job(j);
+	TRACE_END(t, "wait", j->command);
 
 	/* Put the shell back in the foreground. */
+	TRACE_BEGIN(t);
 	tcsetpgrp(shell_terminal, shell_pgid);
 
 	/* Restore the shell’s terminal modes. */
 	tcgetattr(shell_terminal, &j->tmodes);
 	tcsetattr(shell_terminal, TCSADRAIN, &shell_tmodes);
+	TRACE_END(t, "terminal to shell", NULL);
 }
 
 
@@ -165,63 +527,128 @@ void
 put_job_in_background (job * j, int cont)
 {
 	/* Send the job a continue signal, if necessary. */
-	if(cont){
-		if(kill(- j->pgid, SIGCONT) < 0)
-			perror("kill (SIGCONT)");
+	if(cont)
+		continue_signal(j);
+}
+
+
+/* Take the job j out of the queue of jobs waiting for a slot. */
+static
+void
+dequeue_job (job * j)
+{
+	job *q, *prev = NULL;
+
+	for(q = first_queued; q != j; q = q->next_queued)
+		prev = q;
+	if(prev)
+		prev->next_queued = j->next_queued;
+	else
+		first_queued = j->next_queued;
+	if(last_queued == j)
+		last_queued = prev;
+	j->queued = 0;
+	queued_count--;
+}
+
+
+/* Start the queued background jobs that there are free slots for, oldest first. */
+static
+void
+admit_jobs (void)
+{
+	job *j;
+
+	while(first_queued != NULL && (max_jobs == 0 || slots_used < max_jobs)){
+		j = first_queued;
+		dequeue_job(j);
+		start_job(j, 0);
+		j->in_slot = 1;
+		slots_used++;
+		j->started = 1;		/* reported by do_job_notification() */
+		job_changed(j);
 	}
 }
 
 
-/* Continue the job J. */
+/* Return true if a job that holds a slot is running, so that waiting can free the slot. 
+ * Stopped jobs keep their slots until they are continued.
+ */
+static
+int
+slot_may_free (void)
+{
+	job *j;
+	process *p;
+
+	for(j = first_job; j; j = j->next)
+		if(j->in_slot)
+			for(p = j->first_process; p; p = p->next)
+				if(!p->completed && !p->stopped)
+					return 1;
+	return 0;
+}
+
+
+/* Continue the job J. A queued job is started if it is put in the foreground. */
 void
 continue_job (job * j, int foreground)
 {
+	if(j->queued){
+		if(!foreground){
+			fprintf(stderr, "bg: job %ld is waiting for a slot (MAXJOBS)\n", (long) j->jid);
+			return;
+		}
+		dequeue_job(j);
+		j->background = 0;	/* it is not filed as a finished background job */
+		launch_job(j, 1);
+		return;
+	}
+
 	mark_job_as_running(j);
 	if(foreground)
 		put_job_in_foreground(j, 1);
-	else
+	else{
+		j->background = 1;
 		put_job_in_background(j, 1);
+	}
 }
 
 
+/* Everything a job owns lives in its arena, except the counters of its pipes. */
 void
 free_job (job * j)
 {
-	process *p = j -> first_process;
-
-	while(p != NULL){
-		int index = 0;
-		char *tmp_s;
-		while((tmp_s = (p -> argv)[index]) != NULL){
-			free(tmp_s);
-			index++;
-		}
-		free(p -> argv);
-
-		index = 0;
-		while(index < 3){
-			if((tmp_s = ((p -> io_re)[index]).dest) != NULL)
-				free(tmp_s);
-			index++;
-		}
+	arena mem = j -> mem;
 
-		process *pnext = p -> next;
-		free(p);
-		p = pnext;
-	}
+	if(j -> stats != NULL)
+		munmap(j -> stats, sizeof(pipe_stats) * j -> nstats);
 
-	free(j -> command);
-	free(j);
+	arena_free(&mem);
 }
 
 
 /* Make sure the shell is running as the foreground job
- * before proceeding.
+ * before proceeding. Scripts, -c and non-tty input run without
+ * job control, so none of the terminal setup is done for them.
  */
 void
-init_shell (void)
+init_shell (int interactive)
 {
 	shell_terminal = STDIN_FILENO;
+	shell_is_interactive = interactive && isatty(shell_terminal);
+
+	/* Children are reaped through a signalfd, which needs SIGCHLD to be blocked. */
+	sigemptyset(&sigchld_set);
+	sigaddset(&sigchld_set, SIGCHLD);
+	sigprocmask(SIG_BLOCK, &sigchld_set, NULL);
+	if((sigchld_fd = signalfd(-1, &sigchld_set, SFD_NONBLOCK | SFD_CLOEXEC)) == -1){
+		perror("signalfd");	/* update_status() polls instead */
+		sigprocmask(SIG_UNBLOCK, &sigchld_set, NULL);
+	}
+
+	if(!shell_is_interactive)
+		return;
 
     /* Loop until we are in the foreground. */
     while(tcgetpgrp(shell_terminal) != (shell_pgid = getpgrp()))
@@ -256,31 +683,39 @@ init_shell (void)
 
 static
 void
-launch_process (process *p, pid_t pgid,
+launch_process (process *p, char *path, pid_t pgid,
                 int infile, int outfile, int errfile,
-                int foreground)
+                char **envp, int foreground)
 {
 	pid_t pid;
 
+	sigprocmask(SIG_UNBLOCK, &sigchld_set, NULL);	/* blocked by the shell for its signalfd */
+	if(sigchld_fd != -1){	/* a builtin stage (parallel) waits with waitpid() */
+		close(sigchld_fd);
+		sigchld_fd = -1;
+	}
+
     /* Put the process into the process group and give the process group
        the terminal, if appropriate.
        This has to be done both by the shell and in the individual
        child processes because of potential race conditions.
      */
-    pid = getpid();
-    if(pgid == 0)
-    	pgid = pid;
-    setpgid(pid, pgid);
-    if(foreground)
-    	tcsetpgrp(shell_terminal, pgid);
-
-    /* Set the handling for job control signals back to the default. */
-    signal(SIGINT, SIG_DFL);
-    signal(SIGQUIT, SIG_DFL);
-    signal(SIGTSTP, SIG_DFL);
-    signal(SIGTTIN, SIG_DFL);
-    signal(SIGTTOU, SIG_DFL);
-    /* signal(SIGCHLD, SIG_DFL); */
+    if(shell_is_interactive){
+    	pid = getpid();
+    	if(pgid == 0)
+    		pgid = pid;
+    	setpgid(pid, pgid);
+    	if(foreground)
+    		tcsetpgrp(shell_terminal, pgid);
+
+    	/* Set the handling for job control signals back to the default. */
+    	signal(SIGINT, SIG_DFL);
+    	signal(SIGQUIT, SIG_DFL);
+    	signal(SIGTSTP, SIG_DFL);
+    	signal(SIGTTIN, SIG_DFL);
+    	signal(SIGTTOU, SIG_DFL);
+    	/* signal(SIGCHLD, SIG_DFL); */
+    }
 
 	/* Set the standard input/output channels of the new process. */
 	if(infile != STDIN_FILENO){
@@ -301,17 +736,458 @@ launch_process (process *p, pid_t pgid,
 	/* Exec the new process. make sure we exit. */
 	if((p->argv)[0] == NULL)
 		exit(0);
-	execvp(p->argv[0], p->argv);
-	perror ("execvp");
-	exit (1);
+	if(is_builtin((p->argv)[0]))
+		exit(exec_builtin(p->argv));	/* a builtin stage of a pipeline; exit() flushes stdout */
+	if(path == NULL){
+		fprintf(stderr, "%s: command not found\n", p->argv[0]);
+		exit(127);
+	}
+
+	/* path was found in PATH by the shell (pathlib.c), so no search is needed. */
+	execve(path, p->argv, envp);
+	if(errno == ENOEXEC){	/* not an executable format: run it as a shell script, like execvp() */
+		int argc;
+		for(argc = 0; p->argv[argc] != NULL; argc++)
+			;
+		char *sh_argv[argc + 2];
+		sh_argv[0] = "/bin/sh";
+		sh_argv[1] = path;
+		memcpy(&sh_argv[2], &(p->argv)[1], sizeof(char *) * argc);
+		execve("/bin/sh", sh_argv, envp);
+	}else if(errno == ENOENT && path != p->argv[0]){	/* removed since it was cached */
+		environ = envp;		/* the exported variables, maintained by variablelib.c */
+		execvp(p->argv[0], p->argv);
+	}
+	perror(p->argv[0]);
+	exit((errno == ENOENT) ? 127 : 126);
+}
+
+
+/* posix_spawn() does not tell a failed exec from a failed redirection. Return the 
+ * first target of a redirection that cannot be opened, or NULL if the exec failed. 
+ * The targets that were opened before the failure exist by now, so opening them 
+ * again without O_TRUNC changes nothing.
+ */
+static
+const char *
+spawn_failed_redirect (process *p)
+{
+	io_redirect *re = p->io_re;
+	int i, fd;
+
+	for(i = 0; i < 3; i++){
+		if(re[i].dest == NULL)
+			continue;
+		fd = (i == 0) ? open(re[i].dest, O_RDONLY | O_CLOEXEC) 
+		              : open(re[i].dest, O_WRONLY | O_APPEND | O_CLOEXEC);
+		if(fd == -1)
+			return re[i].dest;
+		close(fd);
+	}
+	return NULL;
+}
+
+
+/* Start the process p of the job j with posix_spawn(): the redirections are file 
+ * actions, and the process group and the signal handling of launch_process() are 
+ * attributes. The child does not copy the memory of the shell, which makes a launch 
+ * cheaper as the shell grows. pipe_in is the read end of the pipe to the next process, 
+ * or -1. Return the pid, or -1 if the process has to be started with fork() instead: 
+ * spawn cannot hand it the terminal, the file is a script without #!, or the cached 
+ * path is gone. The file actions have run by then, so fork() is not used for any other 
+ * error: it is reported as launch_process() does, p is marked completed with the exit 
+ * status 1 for a redirection, 127 or 126 for the exec, and -2 is returned.
+ */
+static
+pid_t
+spawn_process (job *j, process *p, char *path,
+               int infile, int outfile, int pipe_in,
+               char **envp, int foreground)
+{
+	posix_spawn_file_actions_t fa;
+	posix_spawnattr_t attr;
+	sigset_t sigs;
+	short flags = 0;
+	io_redirect *re = p->io_re;
+	pid_t pid;
+	mode_t mask;
+	int rv;
+
+#ifndef HAVE_SPAWN_TCSETPGRP
+	if(shell_is_interactive && foreground)
+		return -1;
+#endif
+
+	posix_spawn_file_actions_init(&fa);
+	posix_spawnattr_init(&attr);
+
+	/* the mask of the shell blocks SIGCHLD */
+	flags |= POSIX_SPAWN_SETSIGMASK;
+	sigemptyset(&sigs);
+	posix_spawnattr_setsigmask(&attr, &sigs);
+
+	if(shell_is_interactive){
+		flags |= POSIX_SPAWN_SETPGROUP | POSIX_SPAWN_SETSIGDEF;
+		posix_spawnattr_setpgroup(&attr, j->pgid);
+		sigemptyset(&sigs);
+		sigaddset(&sigs, SIGINT);
+		sigaddset(&sigs, SIGQUIT);
+		sigaddset(&sigs, SIGTSTP);
+		sigaddset(&sigs, SIGTTIN);
+		sigaddset(&sigs, SIGTTOU);
+		posix_spawnattr_setsigdefault(&attr, &sigs);
+#ifdef HAVE_SPAWN_TCSETPGRP
+		if(foreground)	/* before shell_terminal is replaced by the redirections */
+			posix_spawn_file_actions_addtcsetpgrp_np(&fa, shell_terminal);
+#endif
+	}
+	posix_spawnattr_setflags(&attr, flags);
+
+	if(pipe_in != -1)
+		posix_spawn_file_actions_addclose(&fa, pipe_in);
+
+	if(re[0].dest != NULL){		/* standard input */
+		posix_spawn_file_actions_addopen(&fa, STDIN_FILENO, re[0].dest, O_RDONLY, 0);
+		if(infile != STDIN_FILENO)
+			posix_spawn_file_actions_addclose(&fa, infile);
+	}else if(infile != STDIN_FILENO){
+		posix_spawn_file_actions_adddup2(&fa, infile, STDIN_FILENO);
+		posix_spawn_file_actions_addclose(&fa, infile);
+	}
+
+	if(re[1].dest != NULL){		/* standard output */
+		posix_spawn_file_actions_addopen(&fa, STDOUT_FILENO, re[1].dest, 
+		                                 O_WRONLY | O_CREAT | (re[1].is_append ? O_APPEND : O_TRUNC), DEF_MODE);
+		if(outfile != STDOUT_FILENO)
+			posix_spawn_file_actions_addclose(&fa, outfile);
+	}else if(outfile != STDOUT_FILENO){
+		posix_spawn_file_actions_adddup2(&fa, outfile, STDOUT_FILENO);
+		posix_spawn_file_actions_addclose(&fa, outfile);
+	}
+
+	if(re[2].dest != NULL){		/* standard error */
+		posix_spawn_file_actions_addopen(&fa, STDERR_FILENO, re[2].dest, 
+		                                 O_WRONLY | O_CREAT | (re[2].is_append ? O_APPEND : O_TRUNC), DEF_MODE);
+	}else if(j->stderr != STDERR_FILENO){
+		posix_spawn_file_actions_adddup2(&fa, j->stderr, STDERR_FILENO);
+		posix_spawn_file_actions_addclose(&fa, j->stderr);
+	}
+
+	mask = umask(DEF_UMASK);	/* the child of fork() sets it too */
+	rv = posix_spawn(&pid, path, &fa, &attr, p->argv, envp);
+	umask(mask);
+
+	posix_spawn_file_actions_destroy(&fa);
+	posix_spawnattr_destroy(&attr);
+	if(rv == 0)
+		return pid;
+
+	/* the ENOEXEC and stale path cases of launch_process() need fork() */
+	if(rv == ENOEXEC || (rv == ENOENT && path != p->argv[0] && access(path, F_OK) == -1))
+		return -1;
+	const char *target = spawn_failed_redirect(p);
+	fprintf(stderr, "%s: %s\n", (target != NULL) ? target : p->argv[0], strerror(rv));
+	p->status = ((target != NULL) ? 1 : (rv == ENOENT) ? 127 : 126) << 8;	/* as waitpid() reports it */
+	p->completed = 1;
+	clock_gettime(CLOCK_MONOTONIC, &p->end);
+	return -2;
 }
 
 
-/* Format information about job status for the user to look at. */
+/* Choose how processes are started (LAUNCHMODE): "spawn" for posix_spawn(), 
+ * anything else for fork().
+ */
+void
+set_launch_mode (const char * value)
+{
+	launch_spawn = (value != NULL && strcmp(value, "spawn") == 0);
+}
+
+
+/* Set the capacity of new pipes (PIPESIZE) in bytes, with an optional K or M suffix. 
+ * The kernel rounds it up to a power of 2 pages; unprivileged users are limited to 
+ * /proc/sys/fs/pipe-max-size.
+ */
+void
+set_pipe_size (const char * value)
+{
+	char *end;
+	unsigned long size;
+
+	pipe_size = 0;
+	pipe_size_failed = 0;
+	if(value == NULL || *value == '\0')
+		return;
+
+	size = strtoul(value, &end, 10);
+	if(*end == 'K' || *end == 'k')
+		size <<= 10, end++;
+	else if(*end == 'M' || *end == 'm')
+		size <<= 20, end++;
+	if(*end != '\0' || size > INT_MAX){
+		fprintf(stderr, "PIPESIZE: %s: invalid size\n", value);
+		return;
+	}
+	pipe_size = size;
+}
+
+
+/* Turn the pipe instrumentation on if value is "on" (PIPESTATS). */
+void
+set_pipe_stats (const char * value)
+{
+	pipe_stats_on = (value != NULL && strcmp(value, "on") == 0);
+}
+
+
+/* Create a pipe whose ends are closed on exec, with the capacity set by PIPESIZE. */
+static
+void
+make_pipe (int fds[2])
+{
+	if(pipe2(fds, O_CLOEXEC) < 0){
+		perror("pipe");
+		exit(1);
+	}
+	if(pipe_size != 0 && !pipe_size_failed && fcntl(fds[1], F_SETPIPE_SZ, pipe_size) == -1){
+		perror("F_SETPIPE_SZ");
+		pipe_size_failed = 1;
+	}
+}
+
+
+static
+unsigned long long
+monotonic_ns (void)
+{
+	struct timespec ts;
+
+	clock_gettime(CLOCK_MONOTONIC, &ts);
+	return ts.tv_sec * 1000000000ULL + ts.tv_nsec;
+}
+
+
+/* Wait until fd is ready for events, and add the time it took to *ns. The wait is 
+ * cut into slices so that the shell sees a long stall while it is still going on.
+ */
+static
+void
+wait_fd (int fd, short events, unsigned long long * ns)
+{
+	struct pollfd pfd = {fd, events, 0};
+	unsigned long long start = monotonic_ns(), now;
+	int rv;
+
+	do{
+		rv = poll(&pfd, 1, 100);
+		now = monotonic_ns();
+		*ns += now - start;
+		start = now;
+	}while(rv == 0 || (rv == -1 && errno == EINTR));
+}
+
+
+/* The body of a relay process: move everything from in to out with splice(), so the 
+ * data is not copied through user space, and count it in st. When nothing can be moved, 
+ * the time spent waiting for in to become readable is the time the pipe was empty, and 
+ * the time spent waiting for out to become writable is the time it was full.
+ */
+static
+void
+run_relay (pipe_stats * st, int in, int out)
+{
+	struct pollfd pfd = {in, POLLIN, 0};
+	ssize_t n;
+
+	signal(SIGPIPE, SIG_IGN);	/* a reader that is gone ends the relay, which passes it on */
+	for(;;){
+		n = splice(in, NULL, out, NULL, 1 << 20, SPLICE_F_MOVE | SPLICE_F_NONBLOCK);
+		if(n > 0)
+			st->bytes += n;
+		else if(n == 0)
+			break;	/* end of file */
+		else if(errno == EAGAIN){
+			if(poll(&pfd, 1, 0) == 0)
+				wait_fd(in, POLLIN, &st->empty_ns);
+			else
+				wait_fd(out, POLLOUT, &st->full_ns);
+		}else if(errno != EINTR)
+			break;
+	}
+	_exit(0);
+}
+
+
+/* Start a relay process for the pipe whose halves are in and out, and insert 
+ * it into the job j after the writer p.
+ */
+static
+void
+launch_relay (job * j, process * p, pipe_stats * st, int in, int out, int next_in)
+{
+	static char *relay_argv[] = {"[pipe]", NULL};
+	process *r = arena_alloc(&(j -> mem), sizeof(process));
+	pid_t pid;
+
+	memset(r, 0, sizeof(process));
+	r->argv = relay_argv;
+	r->stats = st;
+
+	fflush(stdout);
+	if((pid = fork()) == 0){
+		if(shell_is_interactive){
+			setpgid(0, j->pgid);
+	    	signal(SIGINT, SIG_DFL);
+	    	signal(SIGQUIT, SIG_DFL);
+	    	signal(SIGTSTP, SIG_DFL);
+	    	signal(SIGTTIN, SIG_DFL);
+	    	signal(SIGTTOU, SIG_DFL);
+		}
+		close(next_in);
+		run_relay(st, in, out);
+	}else if(pid < 0){
+		perror("fork");
+		exit(1);
+	}
+	r->pid = pid;
+	index_pid(j, r);
+	if(shell_is_interactive)
+		setpgid(pid, j->pgid);
+
+	r->next = p->next;
+	p->next = r;
+}
+
+
+/* Run the builtin p in the shell as a stage of job j and mark it as completed. 
+ * Its resource usage is only measured if the job is timed; a builtin has no 
+ * peak RSS of its own, so the one of the shell is reported.
+ */
+int
+run_builtin_stage (job * j, process * p, int infile, int outfile)
+{
+	struct rusage before;
+	int status;
+
+	clock_gettime(CLOCK_MONOTONIC, &p->start);
+	if(j->timed)
+		getrusage(RUSAGE_SELF, &before);
+	status = run_builtin(p, infile, outfile, j->stderr);
+	if(j->timed){
+		getrusage(RUSAGE_SELF, &p->ru);
+		timersub(&p->ru.ru_utime, &before.ru_utime, &p->ru.ru_utime);
+		timersub(&p->ru.ru_stime, &before.ru_stime, &p->ru.ru_stime);
+	}
+	clock_gettime(CLOCK_MONOTONIC, &p->end);
+	p->status = status << 8;	/* as waitpid() reports it */
+	p->completed = 1;
+	return status;
+}
+
+
+static
+double
+elapsed (const struct timespec * start, const struct timespec * end)
+{
+	return (end->tv_sec - start->tv_sec) + (end->tv_nsec - start->tv_nsec) / 1e9;
+}
+
+
+static
+void
+print_times (double real, const struct timeval * user, const struct timeval * sys, 
+             long maxrss, const char * label)
+{
+	fprintf(stderr, "%10.3f %10.3f %10.3f %10ldK  %s\n", real, 
+	        user->tv_sec + user->tv_usec / 1e6, sys->tv_sec + sys->tv_usec / 1e6, maxrss, label);
+}
+
+
+/* Print the wall clock time, CPU time and peak RSS of every stage of job j and 
+ * of the whole job. Relays of instrumented pipes only count towards the total.
+ */
+void
+print_job_times (job * j)
+{
+	process *p;
+	struct timespec first = {0, 0}, last = {0, 0};
+	struct timeval user = {0, 0}, sys = {0, 0};
+	long maxrss = 0;
+	char label[48];
+
+	fprintf(stderr, "%10s %10s %10s %11s  %s\n", "real", "user", "sys", "maxrss", "stage");
+	for(p = j->first_process; p; p = p->next){
+		if(p->start.tv_sec == 0 && p->start.tv_nsec == 0)
+			continue;	/* never started */
+		if(first.tv_sec == 0 || elapsed(&p->start, &first) > 0)
+			first = p->start;
+
+		if(p->stats == NULL){
+			size_t len = 0;
+			char **arg;
+			label[0] = '\0';
+			for(arg = p->argv; *arg != NULL && len < sizeof(label) - 1; arg++)
+				len += snprintf(label + len, sizeof(label) - len, (arg == p->argv) ? "%s" : " %s", *arg);
+			if(len >= sizeof(label))
+				memcpy(label + sizeof(label) - 4, "...", 4);
+		}
+
+		if(!p->completed){
+			if(p->stats == NULL)
+				fprintf(stderr, "%10s %10s %10s %11s  %s\n", "-", "-", "-", "-", label);
+			continue;
+		}
+		if(elapsed(&last, &p->end) > 0)
+			last = p->end;
+		timeradd(&user, &p->ru.ru_utime, &user);
+		timeradd(&sys, &p->ru.ru_stime, &sys);
+		if(p->ru.ru_maxrss > maxrss)
+			maxrss = p->ru.ru_maxrss;
+		if(p->stats == NULL)
+			print_times(elapsed(&p->start, &p->end), &p->ru.ru_utime, &p->ru.ru_stime, 
+			            p->ru.ru_maxrss, label);
+	}
+	if(job_is_completed(j))
+		print_times(elapsed(&first, &last), &user, &sys, maxrss, "total");
+}
+
+
+/* Print the finished background jobs that are kept, oldest first, with their times. */
+void
+print_finished_jobs (void)
+{
+	int i, k;
+
+	for(i = 0; i < MAX_FINISHED; i++){
+		k = (finished_next + i) % MAX_FINISHED;
+		if(finished_jobs[k] == NULL)
+			continue;
+		fprintf(stderr, "[%ld] (Finished, status %d): %s\n", (long)finished_jobs[k]->jid, 
+		        job_status(finished_jobs[k]), finished_jobs[k]->command);
+		print_job_times(finished_jobs[k]);
+	}
+}
+
+
+/* Format information about job status for the user to look at, 
+ * followed by the traffic of its pipes if they are instrumented.
+ */
 void
 format_job_info (job * j, const char * status)
 {
+	process *p, *writer = NULL;
+
 	fprintf(stderr, "[%ld] %ld (%s): %s\n", (long)j->jid, (long)j->pgid, status, j->command);
+	for(p = j->first_process; p; p = p->next){
+		if(p->stats == NULL){
+			writer = p;
+			continue;
+		}
+		fprintf(stderr, "    %s | %s: %llu bytes, empty %.3f s, full %.3f s\n", 
+		        writer->argv[0] ? writer->argv[0] : "", 
+		        (p->next && p->next->argv[0]) ? p->next->argv[0] : "", 
+		        p->stats->bytes, p->stats->empty_ns / 1e9, p->stats->full_ns / 1e9);
+	}
 }
 
 
@@ -345,51 +1221,116 @@ job_is_completed (job * j)
 }
 
 
+/* Start the processes of job j. A job that is not on the job list must have jid 0; 
+ * its owner waits for it with wait_for_child() and frees it.
+ */
 void
-launch_job (job *j, int foreground)
+start_job (job *j, int foreground)
 {
 	process *p;
 	pid_t pid;
-	int mypipe[2], infile, outfile, errfile;
+	int mypipe[2], relay[2], infile, outfile, errfile;
+	char **envp = get_environment();
+	pipe_stats *st = NULL;
+	unsigned long long t;
+
+	/* the counters of instrumented pipes are shared with their relays */
+	if(pipe_stats_on && j -> first_process -> next != NULL){
+		for(p = j -> first_process -> next; p; p = p -> next)
+			j -> nstats++;
+		st = mmap(NULL, sizeof(pipe_stats) * j -> nstats, PROT_READ | PROT_WRITE, 
+		          MAP_SHARED | MAP_ANONYMOUS, -1, 0);
+		if(st == MAP_FAILED){
+			perror("mmap");
+			st = NULL;
+			j -> nstats = 0;
+		}
+		j -> stats = st;
+	}
 
 	infile = j -> stdin;
 
 	p = j -> first_process;
 	while(p != NULL){
-		/* set up pipes, if necessary */
+		/* set up pipes, if necessary; the writer gets relay[1] and the relay 
+		 * copies relay[0] to mypipe[1] if the pipe is instrumented
+		 */
+		relay[0] = relay[1] = -1;
 		if(p -> next != NULL){
-			if(pipe(mypipe) < 0){
-				perror ("pipe");
-            	exit (1);
-            }
-        	outfile = mypipe[1];
+			make_pipe(mypipe);
+			if(st != NULL){
+				make_pipe(relay);
+				outfile = relay[1];
+			}else
+        		outfile = mypipe[1];
         }else
         	outfile = j -> stdout;
 
 
-    	/* fork the child processes */
-    	pid = fork();
-    	if(pid == 0){	/* this is the child process */
+    	/* The last stage of a foreground pipeline runs in the shell if it is a builtin. */
+    	if(p -> next == NULL && foreground && (p -> argv)[0] && is_builtin((p -> argv)[0])){
+    		TRACE_BEGIN(t);
+    		run_builtin_stage(j, p, infile, outfile);
+    		TRACE_END(t, "builtin", (p -> argv)[0]);
+    		if(infile != j->stdin)
+    			close(infile);
+    		break;
+    	}
+
+    	/* look the command up in the parent, so that the result is cached; 
+    	 * a builtin has no path, which also keeps it from being spawned
+    	 */
+    	TRACE_BEGIN(t);
+    	char *path = ((p -> argv)[0] && !is_builtin((p -> argv)[0])) ? find_command((p -> argv)[0]) : NULL;
+    	TRACE_END(t, "find_command", (p -> argv)[0]);
+    	clock_gettime(CLOCK_MONOTONIC, &(p -> start));
+
+    	/* fork the child processes, flushing first so that buffered
+    	 * builtin output is neither duplicated nor reordered.
+    	 */
+    	fflush(stdout);
+    	TRACE_BEGIN(t);
+    	if(launch_spawn && path != NULL
+    	   && (pid = spawn_process(j, p, path, infile, outfile, 
+    	                           (p -> next != NULL) ? mypipe[0] : -1, envp, foreground)) != -1){
+    		TRACE_END(t, "posix_spawn", (p -> argv)[0]);
+    	}else if((pid = fork()) > 0)	/* also when spawn cannot be used, e.g. for a script without #! */
+    		TRACE_END(t, "fork", (p -> argv)[0]);
+    	if(pid == -2){	/* the spawn failed and was reported; there is no child */
+    		if(shell_is_interactive && foreground && j->pgid == 0 && p -> next == NULL)
+    			j->pgid = shell_pgid;	/* nothing to hand the terminal to */
+    	}else if(pid == 0){	/* this is the child process */
     		/* Note: need error processing!!! */
     		if(p -> next != NULL)
     			close(mypipe[0]);	/* if return -1 ? */
+    		if(relay[0] != -1){
+    			close(relay[0]);
+    			close(mypipe[1]);
+    		}
 
 	        /* process I/O redirection */
         	char *filename;
         	if((filename = ((p -> io_re)[0]).dest) != NULL){	/* standard input */
         		if(infile != j->stdin)
         			close(infile);
-        		infile = open(filename, O_RDONLY);	/* if return -1 ? */
+        		if((infile = open(filename, O_RDONLY)) == -1){
+        			perror(filename);
+        			exit(1);
+        		}
     		}
 
         	umask(DEF_UMASK);
         	if((filename = ((p -> io_re)[1]).dest) != NULL){	/* standard output */
+        		if(p -> next != NULL)
+        			close(outfile);
         		if(((p -> io_re)[1]).is_append)
         			outfile = open(filename, O_WRONLY | O_CREAT | O_APPEND, DEF_MODE);
         		else
         			outfile = open(filename, O_WRONLY | O_CREAT | O_TRUNC, DEF_MODE);
-        		if(p -> next != NULL)
-        			close(mypipe[1]);
+        		if(outfile == -1){
+        			perror(filename);
+        			exit(1);
+        		}
         	}
 
         	if((filename = ((p -> io_re)[2]).dest) != NULL){	/* standard error */
@@ -397,19 +1338,25 @@ launch_job (job *j, int foreground)
         			errfile = open(filename, O_WRONLY | O_CREAT | O_APPEND, DEF_MODE);
         		else
         			errfile = open(filename, O_WRONLY | O_CREAT | O_TRUNC, DEF_MODE);
+        		if(errfile == -1){
+        			perror(filename);
+        			exit(1);
+        		}
         	}else
         		errfile = j -> stderr;
 
         	/* call launch_process() */
-        	launch_process(p, j->pgid, infile, outfile, errfile, foreground);
+        	launch_process(p, path, j->pgid, infile, outfile, errfile, envp, foreground);
         }else if(pid < 0){	/* the fork failed */
         	perror ("fork");
         	exit (1);
         }else{	/* this is the parent process */
         	p -> pid = pid;
+        	index_pid(j, p);
             if(!(j -> pgid))
             	j -> pgid = pid;
-            setpgid(pid, j->pgid);
+            if(shell_is_interactive)
+            	setpgid(pid, j->pgid);
         }
 
     	/* clean up after pipes */
@@ -419,15 +1366,121 @@ launch_job (job *j, int foreground)
         	close(outfile);
       	infile = mypipe[0];
 
+      	if(relay[0] != -1){
+      		launch_relay(j, p, st++, relay[0], mypipe[1], mypipe[0]);
+      		close(relay[0]);
+      		close(mypipe[1]);
+      		p = p -> next;	/* the relay */
+      	}
       	p = p -> next;
     }
+}
+
+
+void
+launch_job (job *j, int foreground)
+{
+	unsigned long long t;
+
+	if(!foreground)
+		j->background = 1;
+
+	/* a background job needs one of the MAXJOBS slots; the shell only blocks for one 
+	 * while a running job can free it, and queues the job otherwise
+	 */
+	if(!foreground && max_jobs > 0 && max_jobs_block)
+		while(slots_used >= max_jobs && slot_may_free())
+			wait_for_child();
+	if(!foreground && max_jobs > 0 && slots_used >= max_jobs){
+		j->queued = 1;
+		j->next_queued = NULL;
+		if(last_queued)
+			last_queued->next_queued = j;
+		else
+			first_queued = j;
+		last_queued = j;
+		queued_count++;
+		if(shell_is_interactive)
+			format_job_info(j, "Queued");
+		last_status = 0;
+		return;
+	}
+
+	TRACE_BEGIN(t);
+	start_job(j, foreground);
+	TRACE_END(t, "start_job", j->command);
 
 	if(foreground){
     	put_job_in_foreground(j, 0);
 	}else{
-		format_job_info(j, "Launched");
+		j->in_slot = 1;
+		slots_used++;
+		if(shell_is_interactive)
+			format_job_info(j, "Launched");
     	put_job_in_background(j, 0);
+    	last_status = 0;
+	}
+}
+
+
+/* Block until every queued background job has been started, 
+ * or no running job is left to make room for them.
+ */
+void
+wait_for_queue (void)
+{
+	while(first_queued != NULL && slot_may_free())
+		wait_for_child();
+}
+
+
+/* Return true if the job j waits for a MAXJOBS slot. */
+int
+job_is_queued (job * j)
+{
+	return j->queued;
+}
+
+
+/* Print the number of running and queued background jobs, if there is a limit or a queue. */
+void
+print_job_slots (void)
+{
+	if(max_jobs > 0 || queued_count > 0)
+		fprintf(stderr, "background: %ld running, %ld queued, MAXJOBS %ld\n", 
+		        slots_used, queued_count, max_jobs);
+}
+
+
+/* Set the maximum number of background jobs that run at a time (MAXJOBS). 
+ * 0, an empty value or unset means no limit. Raising it starts queued jobs.
+ */
+void
+set_max_jobs (const char * value)
+{
+	char *end;
+	long n = 0;
+
+	if(value != NULL && *value != '\0'){
+		n = strtol(value, &end, 10);
+		if(*end != '\0' || n < 0){
+			fprintf(stderr, "MAXJOBS: %s: invalid number\n", value);
+			return;
+		}
 	}
+	max_jobs = n;
+	admit_jobs();
+}
+
+
+/* Choose what a background job does when all MAXJOBS slots are taken (MAXJOBS_POLICY): 
+ * "block" waits for a slot before the next prompt (or queues the job if every slot is 
+ * held by a stopped job), anything else queues the job.
+ */
+void
+set_max_jobs_policy (const char * value)
+{
+	max_jobs_block = (value != NULL && strcmp(value, "block") == 0);
 }
 
 
@@ -437,52 +1490,143 @@ launch_job (job *j, int foreground)
 void
 update_status (void)
 {
+	struct signalfd_siginfo si[16];
+	struct rusage ru;
 	int status;
 	pid_t pid;
 
+	/* Nothing to reap unless a SIGCHLD has arrived. Several children can share a signal. */
+	if(sigchld_fd != -1){
+		ssize_t n, got = 0;
+		while((n = read(sigchld_fd, si, sizeof(si))) > 0)
+			got += n;
+		if(got == 0)
+			return;
+	}
+
 	do{
-		pid = waitpid(-1, &status, WUNTRACED | WNOHANG);
-	}while(!mark_process_status(pid, status));
+		pid = wait4(-1, &status, WUNTRACED | WNOHANG, &ru);
+	}while(!mark_process_status(pid, status, &ru));
+
+	/* Slots may have become free. */
+	if(first_queued != NULL)
+		admit_jobs();
 }
 
 
-/* Notify the user about stopped or terminated jobs.
- * Delete terminated jobs from the active job list.
+/* Notify the user about the jobs that stopped or terminated since the last time, 
+ * and delete terminated jobs from the active job list. lead is printed before the first 
+ * message. Return the number of messages.
  */
-void
-do_job_notification (void)
+static
+int
+notify_jobs (const char * lead)
 {
-	job *j, *jlast, *jnext;
-
-	/* Update status information for child processes. */
-	update_status();
+	job *j;
+	int count = 0;
 
-	jlast = NULL;
-	for(j = first_job; j; j = jnext)
+	/* Only the jobs that a process status was reported for can have anything to say. */
+	while((j = first_changed) != NULL)
 	{
-    	jnext = j->next;
+		job_unchanged(j);
+
+		if(j->started){
+			j->started = 0;
+			if(shell_is_interactive){
+				if(count++ == 0)
+					fputs(lead, stderr);
+				format_job_info(j, "Started");
+			}
+		}
 
     	if(job_is_completed(j)){
 			/* If all processes have completed, tell the user the job has
         	 * completed and delete it from the list of active jobs.
         	 */
-    		format_job_info(j, "Completed");
-    		if(jlast)
-        		jlast->next = jnext;
-        	else
-        		first_job = jnext;
-        	free_job(j);
+    		if(shell_is_interactive){
+    			if(count++ == 0)
+    				fputs(lead, stderr);
+    			format_job_info(j, "Completed");
+    		}
+        	remove_job(j);
     	}else if(job_is_stopped(j) && !j->notified){
       		/* Notify the user about stopped jobs,
 			 * marking them so that we won’t do this more than once.
       		 */
-        	format_job_info(j, "Stopped");
+        	if(shell_is_interactive){
+    			if(count++ == 0)
+    				fputs(lead, stderr);
+        		format_job_info(j, "Stopped");
+        	}
         	j->notified = 1;
-        	jlast = j;
-    	}else
-    	    /* Don't say anything about jobs that are still running. */
-        	jlast = j;
+    	}
+    	/* Don't say anything about jobs that are still running. */
     }
+    return count;
+}
+
+
+/* Notify the user about stopped or terminated jobs.
+ * Delete terminated jobs from the active job list.
+ */
+void
+do_job_notification (void)
+{
+	/* Update status information for child processes. */
+	update_status();
+	notify_jobs("");
+}
+
+
+/* Block until some child changes state, and record it. 
+ * Return -1 if a signal came first, 0 otherwise.
+ */
+int
+wait_for_child (void)
+{
+	struct pollfd pfd = {sigchld_fd, POLLIN, 0};
+	struct rusage ru;
+	int status;
+	pid_t pid;
+
+	if(sigchld_fd == -1){
+		if((pid = wait4(-1, &status, WUNTRACED, &ru)) == -1)
+			return (errno == EINTR) ? -1 : 0;
+		mark_process_status(pid, status, &ru);
+		return 0;
+	}
+
+	if(poll(&pfd, 1, -1) == -1)
+		return (errno == EINTR) ? -1 : 0;
+	update_status();
+	return 0;
+}
+
+
+/* Return the descriptor that becomes readable when a child changes state, or -1. */
+int
+child_event_fd (void)
+{
+	return sigchld_fd;
+}
+
+
+/* Handle a state change of children while the shell waits for input. 
+ * Return true if a notification was printed (set -b), so the prompt has to be repeated.
+ */
+int
+child_event (void)
+{
+	update_status();
+	return notify_now && notify_jobs("\n") > 0;
+}
+
+
+/* Turn the immediate notification of job state changes (set -b) on or off. */
+void
+set_notify (int on)
+{
+	notify_now = on;
 }
 
 
@@ -2,35 +2,234 @@
  * main.c
  */
 /* $begin main.c */
+#define _POSIX_C_SOURCE 200809L	/* for O_CLOEXEC, see the man pages OPEN(2) and FEATURE_TEST_MACROS(7) */
+
 #include <stdio.h>
 #include <stdlib.h>
+#include <string.h>
+#include <errno.h>
+#include <fcntl.h>
+#include <unistd.h>
+#include <sys/stat.h>
 #include "myshell.h"
+#include "historylib.h"
+#include "variablelib.h"
+#include "pathlib.h"
+#include "tracelib.h"
+#include "snapshotlib.h"
+
+extern char **environ;
 
 
+/* Keep the history of an interactive shell in $HISTFILE, or ~/.myshell_history. */
+static
+void
+open_hist_file (void)
+{
+	char *path = get_value_by_name("HISTFILE");
+	char *home;
+
+	if(path != NULL){
+		if(*path != '\0')
+			init_hist(path);
+		return;
+	}
+
+	if((home = get_value_by_name("HOME")) != NULL){
+		char buf[strlen(home) + sizeof("/" HIST_FILE)];
+		sprintf(buf, "%s/%s", home, HIST_FILE);
+		init_hist(buf);
+	}
+}
+
+
+/* Return true if the job j only changes variables or aliases, in a way that a snapshot 
+ * can replay. A let whose last value is 0 fails, so like any failed command it still 
+ * makes the snapshot invalid.
+ */
+static
 int
-main (int argc, char * argv[])
+replayable (job * j)
 {
-	char *cmdline;
-	char *prompt = DFL_PROMPT;
+	process *p = j -> first_process;
+	int i;
+
+	if(!foreground || p -> next != NULL || (p -> argv)[0] == NULL)
+		return 0;
+	if(strcmp((p -> argv)[0], "set") != 0 && strcmp((p -> argv)[0], "export") != 0 
+	   && strcmp((p -> argv)[0], "unset") != 0 && strcmp((p -> argv)[0], "alias") != 0 
+	   && strcmp((p -> argv)[0], "unalias") != 0 && strcmp((p -> argv)[0], "let") != 0)
+		return 0;
+	for(i = 0; i < 3; i++)
+		if(((p -> io_re)[i]).dest != NULL)
+			return 0;
+	return 1;
+}
+
 
-	init_shell();
+/* Run the commands of the input until its end. While a snapshot is recorded, a command 
+ * that does more than change variables or aliases makes it invalid.
+ */
+static
+void
+run_commands (char * prompt)
+{
+	char *cmdline;
 
-	while((cmdline = next_cmd(prompt, stdin)) != NULL){
-		if(!cmd_is_empty(cmdline)){
-			if(eval_cmd(cmdline) == -1)
+	while((cmdline = next_cmd(prompt)) != NULL){
+		if(is_compound(cmdline)){
+			run_compound(cmdline, prompt ? CONT_PROMPT : NULL);
+		}else if(!cmd_is_empty(cmdline)){
+			unsigned long long t;
+			TRACE_BEGIN(t);
+			if(eval_cmd(cmdline) == -1){
+				last_status = 1;	/* a syntax or expansion error, as run_simple() sets */
+				if(snapshot_recording)
+					snapshot_invalidate();
 				continue;
+			}
 
+			int replay = snapshot_recording && replayable(current_job);
+			int recorded = snapshot_recorded();
 			if(builtin_cmd(current_job) == 0)
 				launch_job(current_job, foreground);
-		}else
-			free(cmdline);
+			if(snapshot_recording && !(replay && last_status == 0 && snapshot_recorded() > recorded))
+				snapshot_invalidate();
+			TRACE_END(t, "command", cmdline);
+		}
 
 		do_job_notification();
 	}
+}
+
+
+/* Run the rc file at path. If snap is not NULL, it names the snapshot of the rc file: 
+ * the snapshot is replayed instead if it is valid, and written otherwise.
+ */
+static
+void
+run_rc_path (const char * path, const char * snap)
+{
+	struct stat st;
+	int fd;
+
+	if(stat(path, &st) == -1 || (snap != NULL && snapshot_load(snap, &st, path)))
+		return;
+	if((fd = open(path, O_RDONLY | O_CLOEXEC)) == -1 || fstat(fd, &st) == -1){
+		if(fd != -1)
+			close(fd);
+		return;
+	}
+
+	char *buf = emalloc(st.st_size + 1);
+	ssize_t n, got = 0;
+	while(got < st.st_size && (n = read(fd, buf + got, st.st_size - got)) > 0)
+		got += n;
+	close(fd);
+	buf[got] = '\0';
+	unsigned long hash = (got == st.st_size) ? hash_bytes(buf, got) : 0;
+	set_input_string(buf);
+	free(buf);
+
+	int recording = record_history;
+	record_history = 0;
+	if(snap != NULL)
+		snapshot_begin();
+	run_commands(NULL);
+	if(snap != NULL)
+		snapshot_end(snap, &st, hash);
+	record_history = recording;
+}
+
+
+/* Run the rc file: $MYSHELLRC, or ~/.myshellrc for an interactive shell. 
+ * If $MYSHELLRC_SNAPSHOT names a file, the changes that the rc file makes to the 
+ * variables and aliases are kept there, and later shells replay them instead of running the 
+ * rc file as long as it has not changed.
+ */
+static
+void
+run_rc_file (int interactive)
+{
+	char *path = get_value_by_name("MYSHELLRC");
+	char *snap = get_value_by_name("MYSHELLRC_SNAPSHOT");
+	char *home;
+
+	if(snap != NULL && *snap == '\0')
+		snap = NULL;
+
+	if(path == NULL && interactive && (home = get_value_by_name("HOME")) != NULL){
+		char buf[strlen(home) + sizeof("/" RC_FILE)];
+		sprintf(buf, "%s/%s", home, RC_FILE);
+		run_rc_path(buf, snap);
+	}else if(path != NULL && *path != '\0')
+		run_rc_path(path, snap);
+}
+
+
+/* Usage: myshell                 - interactive, or read commands from a non-tty stdin
+ *        myshell -c <commands>   - run <commands> and exit
+ *        myshell <script>        - run the commands in the file <script> and exit
+ * An interactive shell first runs ~/.myshellrc, and any shell runs $MYSHELLRC if it is set.
+ */
+int
+main (int argc, char * argv[])
+{
+	char *prompt = DFL_PROMPT;
+	char *commands = NULL;
+	int input = STDIN_FILENO;
+	int interactive = 0;
+
+	watch_variable("HISTSIZE", set_hist_size);
+	watch_variable("HISTCONTROL", set_hist_control);
+	watch_variable("HISTSHARE", set_hist_share);
+	watch_variable("PATH", path_changed);
+	watch_variable("LAUNCHMODE", set_launch_mode);
+	watch_variable("PIPESIZE", set_pipe_size);
+	watch_variable("PIPESTATS", set_pipe_stats);
+	watch_variable("MAXJOBS", set_max_jobs);
+	watch_variable("MAXJOBS_POLICY", set_max_jobs_policy);
+	import_environment(environ);
+
+	if(argc > 1){
+		if(strcmp(argv[1], "-c") == 0){
+			if(argc < 3){
+				fprintf(stderr, "myshell: -c: option requires an argument\n");
+				exit(2);
+			}
+			commands = argv[2];
+		}else if((input = open(argv[1], O_RDONLY | O_CLOEXEC)) == -1){
+			fprintf(stderr, "myshell: %s: %s\n", argv[1], strerror(errno));
+			exit(127);
+		}
+	}else
+		interactive = isatty(STDIN_FILENO);
+
+	init_shell(interactive);
+	if(!shell_is_interactive)
+		record_history = 0;		/* no history for scripts, -c and non-tty input */
+
+	/* the rc file is read before the input, which set_input_string() would replace */
+	run_rc_file(shell_is_interactive);
+	if(commands != NULL)
+		set_input_string(commands);
+	else
+		set_input_fd(input);
+
+	if(!shell_is_interactive)
+		prompt = NULL;
+	else
+		open_hist_file();
+
+	run_commands(prompt);
+
+	/* Queued background jobs have been promised to run. */
+	wait_for_queue();
 
-	printf("logout\n");
-	exit(0);
+	if(shell_is_interactive)
+		printf("logout\n");
+	exit(last_status);
 }
 
 
-/* $end main.c */
\ No newline at end of file
+/* $end main.c */
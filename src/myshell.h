@@ -6,11 +6,19 @@
 #define __MYSHELL_H__
 
 #include <sys/types.h>
+#include <sys/time.h>
+#include <sys/resource.h>
+#include <time.h>
 #include <termios.h>
+#include "wrapper.h"
 
 #define BUF_SIZE	512
 #define ARGV_SIZ	10
 #define DFL_PROMPT	"> "
+#define CONT_PROMPT	"... "	/* prompt of the next lines of a compound command */
+#define HIST_FILE	".myshell_history"	/* default history file in $HOME */
+#define RC_FILE		".myshellrc"		/* rc file of interactive shells, in $HOME */
+#define INPUT_BLOCK	65536	/* size of a single read() of command input */
 
 /* Default file permissions are DEF_MODE & ~DEF_UMASK */
 #define DEF_MODE	S_IRUSR | S_IWUSR | S_IRGRP | S_IWGRP | S_IROTH | S_IWOTH
@@ -28,6 +36,14 @@ typedef struct io_redirect
 	int is_append;
 } io_redirect;
 
+/* Traffic of an instrumented pipe, counted by its relay process in shared memory. */
+typedef struct pipe_stats
+{
+	unsigned long long bytes;	/* bytes that went through the pipe */
+	unsigned long long empty_ns;	/* time the pipe was empty: the reader waited for the writer */
+	unsigned long long full_ns;	/* time the pipe was full: the writer waited for the reader */
+} pipe_stats;
+
 /* A process is a single process. */
 typedef struct process
 {
@@ -38,12 +54,26 @@ typedef struct process
 	char completed;             /* true if process has completed */
 	char stopped;               /* true if process has stopped */
 	int status;                 /* reported status value */
+	pipe_stats *stats;          /* set if this is the relay of an instrumented pipe */
+	struct timespec start;      /* CLOCK_MONOTONIC time of the launch */
+	struct timespec end;        /* ... and of the reaping */
+	struct rusage ru;           /* resource usage reported by wait4() */
 } process;
 
 /* A job is a pipeline of processes. */
 typedef struct job
 {
 	struct job *next;           /* next active job */
+	struct job *prev;           /* previous active job */
+	struct job *next_changed;   /* jobs whose state changed since the last notification */
+	struct job *prev_changed;
+	char changed;               /* true if the job is on that list */
+	char in_slot;               /* true if the job holds one of the MAXJOBS slots */
+	char queued;                /* true if the job waits for a slot */
+	char started;               /* true if it was started from the queue and not reported yet */
+	char timed;                 /* true if the job was started by the time builtin */
+	char background;            /* true if the job was put in the background */
+	struct job *next_queued;    /* next job waiting for a slot */
 	char *command;              /* command line, used for messages */
 	process *first_process;     /* list of processes in this job */
 	pid_t jid;				 	/* job ID */
@@ -51,28 +81,51 @@ typedef struct job
 	char notified;              /* true if user told about stopped job */
 	struct termios tmodes;      /* saved terminal modes */
 	int stdin, stdout, stderr;  /* standard i/o channels */
+	pipe_stats *stats;          /* shared memory of the pipe relays, or NULL */
+	size_t nstats;
+	arena mem;                  /* holds the job, its command and its processes */
 } job;
 
 /* The active jobs are linked into a list. This is its head. */
 extern job *first_job;
 
 extern job *current_job;
-extern pid_t job_id;
 
 extern struct termios shell_tmodes;
 
 extern int foreground;
+extern int shell_is_interactive;
+extern int last_status;
 
 extern job * find_job (pid_t jid);
+extern void insert_job (job * j);
+extern void remove_job (job * j);
 extern void continue_job (job * j, int foreground);
 extern void free_job (job * j);
-extern void init_shell (void);
+extern void init_shell (int interactive);
 extern void format_job_info (job * j, const char * status);
 extern int job_is_stopped (job * j);
 extern int job_is_completed (job * j);
+extern int job_is_queued (job * j);
+extern void print_job_slots (void);
+extern void set_max_jobs (const char * value);
+extern void wait_for_queue (void);
+extern void set_max_jobs_policy (const char * value);
+extern void start_job (job *j, int foreground);
 extern void launch_job (job *j, int foreground);
+extern int job_status (job * j);
+extern int run_builtin_stage (job * j, process * p, int infile, int outfile);
+extern void print_job_times (job * j);
+extern void print_finished_jobs (void);
+extern int wait_for_child (void);
+extern void set_launch_mode (const char * value);
+extern void set_pipe_size (const char * value);
+extern void set_pipe_stats (const char * value);
 extern void update_status (void);
 extern void do_job_notification (void);
+extern int child_event_fd (void);
+extern int child_event (void);
+extern void set_notify (int on);
 /* $end job control */
 
 
@@ -80,7 +133,10 @@ extern void do_job_notification (void);
  * Get Command
  ************/
 /* $begin get command */
-extern char * next_cmd (char * prompt, FILE * fp);
+extern void set_input_fd (int fd);
+extern void set_input_string (char * s);
+extern void push_cmd (const char * line);
+extern char * next_cmd (char * prompt);
 extern int cmd_is_empty (char * cmdline);
 /* $end get command */
 
@@ -89,7 +145,16 @@ extern int cmd_is_empty (char * cmdline);
  * Evaluate Command
  *****************/
 /* $begin evaluate command */
+typedef struct cmd_template cmd_template;	/* a compiled command, see eval_cmd.c */
+
+extern int record_history;
 extern int eval_cmd (char * cmdline);
+extern char * scan_cmd (char * cmdline, size_t * len);
+extern cmd_template * compile_text (const char * text, arena * mem);
+extern int instantiate_cmd (const cmd_template * t, const char * text, size_t len);
+extern char ** expand_args (const cmd_template * t, arena * mem);
+extern void clear_cmdcache (void);
+extern void print_cmdcache_stats (void);
 /* $end evaluate command */
 
 
@@ -98,8 +163,20 @@ extern int eval_cmd (char * cmdline);
  ****************/
 /* $begin builtin command */
 extern int builtin_cmd (job * j);
+extern int is_builtin (const char * name);
+extern int exec_builtin (char ** argv);
+extern int run_builtin (process * p, int infile, int outfile, int errfile);
 /* $end builtin command */
 
 
+/******************
+ * Compound Command
+ *****************/
+/* $begin compound command */
+extern int is_compound (const char * line);
+extern int run_compound (char * line, char * prompt);
+/* $end compound command */
+
+
 #endif /* __MYSHELL_H__ */
 /* $end myshell.h */
\ No newline at end of file
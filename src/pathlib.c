@@ -0,0 +1,232 @@
+/* 
+ * pathlib.c
+ *
+ * Note: 
+ *   The shell looks up the commands in PATH itself, once, and keeps the result in a 
+ *   hash table, so a child process can execve() the full pathname directly instead of 
+ *   trying every directory of PATH like execvp() does. Commands that are not found are 
+ *   remembered too. The table is cleared whenever PATH changes, and by hash -r.
+ */
+/* $begin pathlib.c */
+#define _POSIX_C_SOURCE 200809L	/* for the X_OK of access(), see FEATURE_TEST_MACROS(7) */
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+#include <sys/types.h>
+#include <sys/stat.h>
+#include "pathlib.h"
+#include "variablelib.h"
+#include "wrapper.h"
+
+
+#define DFL_PATH		"/bin:/usr/bin"	/* the search path of execvp() when PATH is unset */
+#define PATH_TABLE_MIN	64				/* initial number of slots, a power of 2 */
+
+typedef struct path_entry
+{
+	char *name;
+	char *path;				/* full pathname of the command, NULL if it was not found */
+	unsigned long hash;		/* cached hash of name */
+	int hits;				/* times the entry was used */
+} path_entry;
+
+static path_entry **path_table = NULL;	/* open addressing, linear probing */
+static size_t       table_size = 0;
+static size_t       path_count = 0;
+static int          path_relative = 0;	/* the entries depend on the working directory */
+
+
+/* Return the full pathname of the executable file name in PATH, allocated by 
+ * emalloc(), or NULL if there is none.
+ */
+static
+char *
+search_path (const char * name)
+{
+	const char *dirs = get_value_by_name("PATH");
+	const char *p, *end;
+	size_t name_len = strlen(name);
+	struct stat st;
+
+	if(dirs == NULL)
+		dirs = DFL_PATH;
+
+	for(p = dirs; ; p = end + 1){
+		if((end = strchr(p, ':')) == NULL)
+			end = p + strlen(p);
+
+		size_t dir_len = end - p;
+		const char *dir = p;
+		if(dir_len == 0){	/* an empty entry is the current directory */
+			dir = ".";
+			dir_len = 1;
+		}
+		if(*dir != '/')
+			path_relative = 1;
+		char *path = emalloc(dir_len + 1 + name_len + 1);
+		memcpy(path, dir, dir_len);
+		path[dir_len] = '/';
+		memcpy(&path[dir_len + 1], name, name_len + 1);
+
+		if(stat(path, &st) == 0 && S_ISREG(st.st_mode) && access(path, X_OK) == 0)
+			return path;
+		free(path);
+
+		if(*end == '\0')
+			return NULL;
+	}
+}
+
+
+/* Return the slot of name, which is empty if name is not in the table. */
+static
+size_t
+find_slot (const char * name, unsigned long hash)
+{
+	size_t mask = table_size - 1;
+	size_t i;
+
+	for(i = hash & mask; path_table[i] != NULL; i = (i + 1) & mask)
+		if(path_table[i] -> hash == hash && strcmp(path_table[i] -> name, name) == 0)
+			break;
+	return i;
+}
+
+
+/* Look name up in PATH and put the result into the table. */
+static
+path_entry *
+add_entry (char * name, unsigned long hash)
+{
+	size_t i;
+
+	if((path_count + 1) * 4 > table_size * 3){
+		path_entry **old = path_table;
+		size_t old_size = table_size;
+		table_size = table_size ? table_size * 2 : PATH_TABLE_MIN;
+		path_table = emalloc(sizeof(path_entry *) * table_size);
+		memset(path_table, 0, sizeof(path_entry *) * table_size);
+		for(i = 0; i < old_size; i++)
+			if(old[i] != NULL)
+				path_table[find_slot(old[i] -> name, old[i] -> hash)] = old[i];
+		free(old);
+	}
+
+	path_entry *e = emalloc(sizeof(path_entry));
+	size_t name_len = strlen(name);
+	e -> name = emalloc(name_len + 1);
+	memcpy(e -> name, name, name_len + 1);
+	e -> path = search_path(name);
+	e -> hash = hash;
+	e -> hits = 0;
+
+	path_table[find_slot(name, hash)] = e;
+	path_count++;
+	return e;
+}
+
+
+/* Return the full pathname of the command name, or NULL if it is not found. 
+ * A name that contains a slash is returned as it is.
+ */
+char *
+find_command (char * name)
+{
+	unsigned long hash;
+	path_entry *e;
+
+	if(strchr(name, '/') != NULL)
+		return name;
+
+	hash = hash_bytes(name, strlen(name));
+	if(table_size == 0 || (e = path_table[find_slot(name, hash)]) == NULL)
+		e = add_entry(name, hash);
+	e -> hits++;
+	return e -> path;
+}
+
+
+/* Look the command name up in PATH again and remember the result (hash <name>). 
+ * Return 0 if it is found, -1 if not.
+ */
+int
+hash_command (char * name)
+{
+	unsigned long hash = hash_bytes(name, strlen(name));
+	path_entry *e;
+
+	if(strchr(name, '/') != NULL)
+		return 0;
+
+	if(table_size != 0 && (e = path_table[find_slot(name, hash)]) != NULL){
+		free(e -> path);
+		e -> path = search_path(name);
+		e -> hits = 0;
+	}else{
+		e = add_entry(name, hash);
+	}
+	return (e -> path != NULL) ? 0 : -1;
+}
+
+
+void
+clear_path_cache (void)
+{
+	size_t i;
+
+	for(i = 0; i < table_size; i++){
+		if(path_table[i] != NULL){
+			free(path_table[i] -> name);
+			free(path_table[i] -> path);
+			free(path_table[i]);
+			path_table[i] = NULL;
+		}
+	}
+	path_count = 0;
+	path_relative = 0;
+}
+
+
+/* Called when PATH is set or unset. */
+void
+path_changed (const char * value)
+{
+	clear_path_cache();
+}
+
+
+/* Called when the working directory changes. */
+void
+cwd_changed (void)
+{
+	if(path_relative)
+		clear_path_cache();
+}
+
+
+void
+print_path_cache (void)
+{
+	size_t i;
+
+	if(path_count == 0){
+		printf("hash: hash table empty\n");
+		return;
+	}
+
+	printf("hits\tcommand\n");
+	for(i = 0; i < table_size; i++){
+		path_entry *e = path_table[i];
+		if(e == NULL)
+			continue;
+		if(e -> path != NULL)
+			printf("%4d\t%s\n", e -> hits, e -> path);
+		else
+			printf("%4d\t%s (not found)\n", e -> hits, e -> name);
+	}
+}
+
+
+/* $end pathlib.c */
@@ -0,0 +1,18 @@
+/* 
+ * pathlib.h
+ */
+/* $begin pathlib.h */
+#ifndef __PATHLIB_H__
+#define __PATHLIB_H__
+
+
+extern char * find_command (char * name);
+extern int hash_command (char * name);
+extern void clear_path_cache (void);
+extern void path_changed (const char * value);
+extern void cwd_changed (void);
+extern void print_path_cache (void);
+
+
+#endif /* __PATHLIB_H__ */
+/* $end pathlib.h */
@@ -0,0 +1,340 @@
+/*
+ * snapshotlib.c
+ *
+ * Note:
+ *   A snapshot is the compiled form of the rc file: the changes it made to the shell
+ *   variables and aliases, in order, as one flat binary file. A warm start maps the file
+ *   with a single mmap() and replays the changes, so the rc file is neither read nor
+ *   parsed. While the rc file runs, the set, export, unset, alias and unalias builtins
+ *   record their changes with snapshot_record(), and the expansion of $name records the
+ *   variables that the
+ *   rc file depends on with snapshot_depend(). Any other command (an external command,
+ *   output, a redirection, ~) has effects that cannot be replayed, so it calls
+ *   snapshot_invalidate() and no snapshot is written for that rc file.
+ *   The file starts with a snap_header and is followed by the records:
+ *     ndeps dependencies: a byte (1 if the variable was in the environment), the name
+ *                         and, if it was, the value, each followed by a '\0'
+ *     nops changes:       a byte SNAP_*, the name and, for SNAP_SET and SNAP_ALIAS, the value
+ *   A snapshot is used if the version matches, the rc file has the same mtime and size
+ *   (or, failing that, the same size and hash of its contents), and every dependency
+ *   has the same value in the environment as when it was written.
+ */
+/* $begin snapshotlib.c */
+#define _POSIX_C_SOURCE 200809L	/* for O_CLOEXEC and st_mtim, see FEATURE_TEST_MACROS(7) */
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <stdint.h>
+#include <errno.h>
+#include <fcntl.h>
+#include <unistd.h>
+#include <sys/types.h>
+#include <sys/stat.h>
+#include <sys/mman.h>
+#include "snapshotlib.h"
+#include "variablelib.h"
+#include "aliaslib.h"
+#include "wrapper.h"
+
+
+#define SNAP_MAGIC		"MYSHSNAP"
+#define SNAP_VERSION	2
+
+typedef struct snap_header
+{
+	char magic[8];
+	uint32_t version;
+	uint32_t ndeps;
+	uint32_t nops;
+	uint32_t pad;
+	int64_t rc_sec;				/* mtime of the rc file */
+	int64_t rc_nsec;
+	uint64_t rc_size;
+	uint64_t rc_hash;			/* hash_bytes() of its contents */
+	uint64_t size;				/* size of the snapshot, header included */
+} snap_header;
+
+/* A growable byte buffer for the records. */
+typedef struct snap_buf
+{
+	char *s;
+	size_t len;
+	size_t size;
+} snap_buf;
+
+int snapshot_recording = 0;
+
+static int snap_valid;
+static snap_buf ops, deps;
+static uint32_t nops, ndeps;
+
+
+static
+void
+buf_put (snap_buf * b, const void * p, size_t n)
+{
+	if(b -> len + n > b -> size){
+		size_t size = b -> size ? b -> size : 1024;
+		while(b -> len + n > size)
+			size *= 2;
+		b -> s = erealloc(b -> s, size);
+		b -> size = size;
+	}
+	memcpy(b -> s + b -> len, p, n);
+	b -> len += n;
+}
+
+
+static
+void
+buf_put_str (snap_buf * b, const char * s)
+{
+	buf_put(b, s, strlen(s) + 1);
+}
+
+
+/* Start recording the changes of the rc file. */
+void
+snapshot_begin (void)
+{
+	ops.len = deps.len = 0;
+	nops = ndeps = 0;
+	snap_valid = 1;
+	snapshot_recording = 1;
+}
+
+
+void
+snapshot_record (int op, const char * name, const char * value)
+{
+	char c = op;
+
+	buf_put(&ops, &c, 1);
+	buf_put_str(&ops, name);
+	if(op == SNAP_SET || op == SNAP_ALIAS)
+		buf_put_str(&ops, value);
+	nops++;
+}
+
+
+/* The rc file used the value of the variable name. What matters is the value it had
+ * when the shell started, so that is taken from the environment.
+ */
+void
+snapshot_depend (const char * name)
+{
+	const char *p = deps.s, *end = deps.s + deps.len;
+	char *value = getenv(name);
+	char c = (value != NULL);
+
+	while(p < end){		/* already there? */
+		int present = *p++;
+		if(strcmp(p, name) == 0)
+			return;
+		p += strlen(p) + 1;
+		if(present)
+			p += strlen(p) + 1;
+	}
+
+	buf_put(&deps, &c, 1);
+	buf_put_str(&deps, name);
+	if(value != NULL)
+		buf_put_str(&deps, value);
+	ndeps++;
+}
+
+
+void
+snapshot_invalidate (void)
+{
+	snap_valid = 0;
+}
+
+
+/* Return the number of changes recorded so far. */
+int
+snapshot_recorded (void)
+{
+	return nops;
+}
+
+
+/* Stop recording, and write the snapshot to path if the rc file can be replayed.
+ * The file is written under a temporary name and renamed, so that a shell that
+ * starts at the same time sees either the old snapshot or the new one.
+ */
+void
+snapshot_end (const char * path, const struct stat * rc_st, unsigned long rc_hash)
+{
+	snap_header h;
+	int fd;
+
+	snapshot_recording = 0;
+	if(!snap_valid){
+		unlink(path);	/* it belongs to an older rc file */
+		return;
+	}
+
+	memset(&h, 0, sizeof(h));
+	memcpy(h.magic, SNAP_MAGIC, sizeof(h.magic));
+	h.version = SNAP_VERSION;
+	h.ndeps = ndeps;
+	h.nops = nops;
+	h.rc_sec = rc_st -> st_mtim.tv_sec;
+	h.rc_nsec = rc_st -> st_mtim.tv_nsec;
+	h.rc_size = rc_st -> st_size;
+	h.rc_hash = rc_hash;
+	h.size = sizeof(h) + deps.len + ops.len;
+
+	char tmp[strlen(path) + 32];
+	snprintf(tmp, sizeof(tmp), "%s.%ld", path, (long) getpid());
+	if((fd = open(tmp, O_WRONLY | O_CREAT | O_TRUNC | O_CLOEXEC, 0600)) == -1)
+		return;		/* the snapshot is only an optimization */
+	if(write(fd, &h, sizeof(h)) != sizeof(h)
+	   || write(fd, deps.s, deps.len) != (ssize_t) deps.len
+	   || write(fd, ops.s, ops.len) != (ssize_t) ops.len
+	   || close(fd) == -1
+	   || rename(tmp, path) == -1)
+		unlink(tmp);
+}
+
+
+/* Return the string that starts at *pp and move *pp past it, or NULL if it is not
+ * terminated before end.
+ */
+static
+const char *
+next_str (const char ** pp, const char * end)
+{
+	const char *s = *pp;
+	const char *nul = memchr(s, '\0', end - s);
+
+	if(nul == NULL)
+		return NULL;
+	*pp = nul + 1;
+	return s;
+}
+
+
+/* Return true if the rc file at rc_path has the hash hash. */
+static
+int
+same_contents (const char * rc_path, size_t size, uint64_t hash)
+{
+	char *buf = emalloc(size + 1);
+	ssize_t n = 0, got = 0;
+	int fd, same = 0;
+
+	if((fd = open(rc_path, O_RDONLY | O_CLOEXEC)) != -1){
+		while(got < (ssize_t) size && (n = read(fd, buf + got, size - got)) > 0)
+			got += n;
+		close(fd);
+		same = (got == (ssize_t) size && hash_bytes(buf, size) == hash);
+	}
+	free(buf);
+	return same;
+}
+
+
+/* Check the snapshot at path against the rc file (its stat rc_st) and the environment.
+ * If it is valid, replay its changes and return 1. Return 0 otherwise, changing nothing.
+ */
+int
+snapshot_load (const char * path, const struct stat * rc_st, const char * rc_path)
+{
+	struct stat st;
+	const snap_header *h;
+	const char *base, *p, *end, *name, *value;
+	void *map;
+	uint32_t i;
+	int fd, ok = 0;
+
+	if((fd = open(path, O_RDONLY | O_CLOEXEC)) == -1)
+		return 0;
+	if(fstat(fd, &st) == -1 || st.st_size < (off_t) sizeof(snap_header)){
+		close(fd);
+		return 0;
+	}
+	map = mmap(NULL, st.st_size, PROT_READ, MAP_PRIVATE, fd, 0);
+	close(fd);
+	if(map == MAP_FAILED)
+		return 0;
+
+	base = map;
+	h = map;
+	end = base + st.st_size;
+	if(memcmp(h -> magic, SNAP_MAGIC, sizeof(h -> magic)) != 0 || h -> version != SNAP_VERSION
+	   || h -> size != (uint64_t) st.st_size || h -> rc_size != (uint64_t) rc_st -> st_size)
+		goto out;
+	if((h -> rc_sec != rc_st -> st_mtim.tv_sec || h -> rc_nsec != rc_st -> st_mtim.tv_nsec)
+	   && !same_contents(rc_path, rc_st -> st_size, h -> rc_hash))
+		goto out;
+
+	/* the environment must give the rc file the same values */
+	p = base + sizeof(snap_header);
+	for(i = 0; i < h -> ndeps; i++){
+		int present;
+		if(p >= end)
+			goto out;
+		present = *p++;
+		if((name = next_str(&p, end)) == NULL)
+			goto out;
+		value = present ? next_str(&p, end) : NULL;
+		if(present && value == NULL)
+			goto out;
+		char *env = getenv(name);
+		if((env == NULL) != (value == NULL) || (env != NULL && strcmp(env, value) != 0))
+			goto out;
+	}
+
+	/* check all the changes before making any */
+	const char *first_op = p;
+	for(i = 0; i < h -> nops; i++){
+		int op;
+		if(p >= end)
+			goto out;
+		op = *p++;
+		if(op < SNAP_SET || op > SNAP_UNALIAS_ALL || next_str(&p, end) == NULL
+		   || ((op == SNAP_SET || op == SNAP_ALIAS) && next_str(&p, end) == NULL))
+			goto out;
+	}
+
+	p = first_op;
+	for(i = 0; i < h -> nops; i++){
+		int op = *p++;
+		name = next_str(&p, end);
+		switch (op) {
+			case SNAP_SET:
+				value = next_str(&p, end);
+				set_variable((char *) name, (char *) value);
+				break;
+			case SNAP_EXPORT:
+				export_variable((char *) name);
+				break;
+			case SNAP_UNSET:
+				delete_variable((char *) name);
+				break;
+			case SNAP_UNEXPORT:
+				unexport_variable((char *) name);
+				break;
+			case SNAP_ALIAS:
+				set_alias(name, next_str(&p, end));
+				break;
+			case SNAP_UNALIAS:
+				remove_alias(name);
+				break;
+			case SNAP_UNALIAS_ALL:
+				clear_aliases();
+				break;
+		}
+	}
+	ok = 1;
+
+out:
+	munmap(map, st.st_size);
+	return ok;
+}
+
+
+/* $end snapshotlib.c */
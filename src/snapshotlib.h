@@ -0,0 +1,33 @@
+/* 
+ * snapshotlib.h
+ */
+/* $begin snapshotlib.h */
+#ifndef __SNAPSHOTLIB_H__
+#define __SNAPSHOTLIB_H__
+
+
+#include <sys/types.h>
+#include <sys/stat.h>
+
+/* The changes to the shell state that a snapshot replays. */
+#define SNAP_SET		1		/* set name value */
+#define SNAP_EXPORT		2		/* export name */
+#define SNAP_UNSET		3		/* unset name */
+#define SNAP_UNEXPORT	4		/* unset -x name */
+#define SNAP_ALIAS		5		/* alias name=value */
+#define SNAP_UNALIAS	6		/* unalias name */
+#define SNAP_UNALIAS_ALL	7	/* unalias -a, with an empty name */
+
+extern int snapshot_recording;
+
+extern void snapshot_begin (void);
+extern void snapshot_record (int op, const char * name, const char * value);
+extern void snapshot_depend (const char * name);
+extern void snapshot_invalidate (void);
+extern int snapshot_recorded (void);
+extern void snapshot_end (const char * path, const struct stat * rc_st, unsigned long rc_hash);
+extern int snapshot_load (const char * path, const struct stat * rc_st, const char * rc_path);
+
+
+#endif /* __SNAPSHOTLIB_H__ */
+/* $end snapshotlib.h */
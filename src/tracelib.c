@@ -0,0 +1,162 @@
+/* 
+ * tracelib.c
+ *
+ * Note: 
+ *   The phases of the shell are recorded as complete events (begin time and duration, 
+ *   CLOCK_MONOTONIC in nanoseconds) in a ring that keeps the last trace_size of them. 
+ *   trace_dump() writes the ring in the Trace Event Format of Chrome, which 
+ *   chrome://tracing and Perfetto load. Nested phases show up nested, since they 
+ *   share the process and thread id of the shell.
+ *   Only the shell records events: phases that run in a child, such as the exec of 
+ *   the command, show up as the gap between its fork and the end of the job.
+ */
+/* $begin tracelib.c */
+#define _POSIX_C_SOURCE 200809L	/* for clock_gettime(), see FEATURE_TEST_MACROS(7) */
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+#include <unistd.h>
+#include "tracelib.h"
+#include "wrapper.h"
+
+
+#define TRACE_SIZE		4096	/* default number of events kept */
+#define DETAIL_SIZE		48		/* bytes of the detail string kept, with the '\0' */
+
+typedef struct trace_rec
+{
+	const char *name;			/* a string literal */
+	unsigned long long start;	/* ns */
+	unsigned long long dur;		/* ns */
+	char detail[DETAIL_SIZE];
+} trace_rec;
+
+int trace_enabled = 0;
+
+static trace_rec *ring = NULL;
+static long trace_size = 0;
+static unsigned long long recorded = 0;	/* events recorded since the last clear */
+
+
+unsigned long long
+trace_now (void)
+{
+	struct timespec ts;
+
+	clock_gettime(CLOCK_MONOTONIC, &ts);
+	return (unsigned long long) ts.tv_sec * 1000000000ULL + ts.tv_nsec;
+}
+
+
+/* Record the phase name that began at start and ends now. detail may be NULL. */
+void
+trace_event (const char * name, const char * detail, unsigned long long start)
+{
+	trace_rec *r = &ring[recorded++ % trace_size];
+
+	r -> name = name;
+	r -> start = start;
+	r -> dur = trace_now() - start;
+	size_t len = (detail != NULL) ? strnlen(detail, DETAIL_SIZE - 1) : 0;
+	if(len > 0)
+		memcpy(r -> detail, detail, len);
+	(r -> detail)[len] = '\0';
+}
+
+
+/* Turn tracing on, keeping the last size events (the default if size is 0, at most 
+ * TRACE_SIZE_MAX). A new size drops the events recorded so far.
+ */
+void
+trace_start (long size)
+{
+	if(size <= 0)
+		size = (trace_size > 0) ? trace_size : TRACE_SIZE;
+	if(size > TRACE_SIZE_MAX)
+		size = TRACE_SIZE_MAX;
+	if(size != trace_size){
+		free(ring);
+		ring = emalloc(sizeof(trace_rec) * size);
+		trace_size = size;
+		recorded = 0;
+	}
+	trace_enabled = 1;
+}
+
+
+void
+trace_stop (void)
+{
+	trace_enabled = 0;
+}
+
+
+void
+trace_clear (void)
+{
+	recorded = 0;
+}
+
+
+static
+void
+put_json_string (FILE * fp, const char * s)
+{
+	putc('"', fp);
+	for(; *s != '\0'; s++){
+		unsigned char c = *s;
+		if(c == '"' || c == '\\')
+			fprintf(fp, "\\%c", c);
+		else if(c < 0x20)
+			fprintf(fp, "\\u%04x", c);
+		else
+			putc(c, fp);
+	}
+	putc('"', fp);
+}
+
+
+/* Write the events in the ring, oldest first, as a Chrome trace (JSON). */
+void
+trace_dump (FILE * fp)
+{
+	unsigned long long i, first = 0;
+	long pid = (long) getpid();
+
+	if(recorded > (unsigned long long) trace_size)
+		first = recorded - trace_size;
+
+	fprintf(fp, "{\"displayTimeUnit\":\"ms\",\"traceEvents\":[\n");
+	fprintf(fp, "{\"name\":\"process_name\",\"ph\":\"M\",\"pid\":%ld,\"tid\":%ld,"
+	            "\"args\":{\"name\":\"myshell\"}}", pid, pid);
+	for(i = first; i < recorded; i++){
+		trace_rec *r = &ring[i % trace_size];
+		fprintf(fp, ",\n{\"name\":\"%s\",\"cat\":\"shell\",\"ph\":\"X\",\"pid\":%ld,\"tid\":%ld,"
+		            "\"ts\":%llu.%03llu,\"dur\":%llu.%03llu", r -> name, pid, pid, 
+		        r -> start / 1000, r -> start % 1000, r -> dur / 1000, r -> dur % 1000);
+		if((r -> detail)[0] != '\0'){
+			fprintf(fp, ",\"args\":{\"detail\":");
+			put_json_string(fp, r -> detail);
+			putc('}', fp);
+		}
+		putc('}', fp);
+	}
+	fprintf(fp, "\n]}\n");
+}
+
+
+void
+print_trace_stats (void)
+{
+	unsigned long long kept = recorded;
+
+	if(kept > (unsigned long long) trace_size)
+		kept = trace_size;
+	printf("tracing %s, %llu events recorded, %llu kept (ring of %ld)\n", 
+	       trace_enabled ? "on" : "off", recorded, kept, trace_size);
+}
+
+
+/* $end tracelib.c */
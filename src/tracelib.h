@@ -0,0 +1,35 @@
+/* 
+ * tracelib.h
+ */
+/* $begin tracelib.h */
+#ifndef __TRACELIB_H__
+#define __TRACELIB_H__
+
+
+#include <stdio.h>
+
+#define TRACE_SIZE_MAX	1048576	/* most events kept, about 72 MB */
+
+extern int trace_enabled;
+
+extern unsigned long long trace_now (void);
+extern void trace_event (const char * name, const char * detail, unsigned long long start);
+extern void trace_start (long size);
+extern void trace_stop (void);
+extern void trace_clear (void);
+extern void trace_dump (FILE * fp);
+extern void print_trace_stats (void);
+
+/* Time a phase of the shell. The start time is 0 while tracing is off, so a phase 
+ * costs a load and a branch unless it is traced:
+ *     unsigned long long t;
+ *     TRACE_BEGIN(t);
+ *     ...
+ *     TRACE_END(t, "fork", argv[0]);
+ */
+#define TRACE_BEGIN(t)				((t) = trace_enabled ? trace_now() : 0)
+#define TRACE_END(t, name, detail)	do{ if(t) trace_event((name), (detail), (t)); }while(0)
+
+
+#endif /* __TRACELIB_H__ */
+/* $end tracelib.h */
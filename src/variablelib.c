@@ -1,7 +1,13 @@
 /* 
  * variablelib.c
  * 
- * Note: Only local variables are supported, not environment variables.
+ * Note: 
+ *   The variables are kept in an open-addressing hash table (linear probing) that 
+ *   caches the hash of each name, and are also linked in insertion order so that 
+ *   print_variable_list() lists them in the order they were created.
+ *   Exported variables also keep a "name=value" string in the environment array 
+ *   returned by get_environment(). The array is patched whenever an exported variable 
+ *   changes, so a child process can use it for exec without building anything.
  */
 /* $begin variablelib.c */
 #include <stdio.h>
@@ -11,47 +17,213 @@
 #include "wrapper.h"
 
 
-/* The variables are linked into a list. This is its head. */
+#define VAR_TABLE_MIN	64		/* initial number of slots, a power of 2 */
+
+typedef struct var_slot
+{
+	unsigned long hash;
+	variable *var;				/* NULL if empty, DELETED if the variable was deleted */
+} var_slot;
+
+static variable deleted_variable;
+#define DELETED			(&deleted_variable)
+
+static var_slot *var_table = NULL;
+static size_t    table_size = 0;		/* number of slots */
+static size_t    table_used = 0;		/* slots that are not empty, including deleted ones */
+static size_t    var_count = 0;
+
+/* The variables are linked into a list in insertion order. These are its ends. */
 static variable *first_variable = NULL;
+static variable *last_variable = NULL;
+
+/* The environment of the child processes: the env_entry of every exported variable. */
+static char  **env_list = NULL;
+static variable **env_vars = NULL;		/* env_vars[i] owns env_list[i] */
+static size_t  env_count = 0;
+static size_t  env_size = 0;
+
+/* Functions that are called when a variable of the given name changes. */
+#define MAX_WATCHES		16
+
+static struct
+{
+	const char *name;
+	void (*fn)(const char *value);
+} watches[MAX_WATCHES];
+static int watch_count = 0;
+
+
+/* Rewrite the environment entry of the exported variable var. */
+static
+void
+update_env_entry (variable * var)
+{
+	size_t name_len = strlen(var -> name);
+	size_t value_len = strlen(var -> value);
+	size_t len = name_len + 1 + value_len + 1;
+
+	if(len > var -> env_size){
+		free(var -> env_entry);
+		var -> env_entry = emalloc(len);
+		var -> env_size = len;
+		env_list[var -> env_index] = var -> env_entry;
+	}
+	memcpy(var -> env_entry, var -> name, name_len);
+	(var -> env_entry)[name_len] = '=';
+	memcpy(&(var -> env_entry)[name_len + 1], var -> value, value_len + 1);
+}
+
+
+static
+void
+add_env_entry (variable * var)
+{
+	if(var -> env_index != -1)
+		return;
+
+	if(env_count + 1 >= env_size){
+		env_size = env_size ? env_size * 2 : 64;
+		env_list = erealloc(env_list, sizeof(char *) * env_size);
+		env_vars = erealloc(env_vars, sizeof(variable *) * env_size);
+	}
+	var -> env_index = env_count;
+	env_vars[env_count] = var;
+	env_list[env_count++] = NULL;
+	env_list[env_count] = NULL;
+	update_env_entry(var);
+}
+
+
+/* Remove the entry of var by moving the last entry into its place. */
+static
+void
+remove_env_entry (variable * var)
+{
+	int i = var -> env_index;
+	if(i == -1)
+		return;
+
+	env_count--;
+	env_list[i] = env_list[env_count];
+	env_vars[i] = env_vars[env_count];
+	env_vars[i] -> env_index = i;
+	env_list[env_count] = NULL;
+
+	free(var -> env_entry);
+	var -> env_entry = NULL;
+	var -> env_size = 0;
+	var -> env_index = -1;
+}
+
+
+/* Tell the watchers of the variable name about its new value (NULL if it was deleted). */
+static
+void
+notify_watches (const char * name, const char * value)
+{
+	int i;
+
+	for(i = 0; i < watch_count; i++)
+		if(strcmp(watches[i].name, name) == 0)
+			watches[i].fn(value);
+}
+
+
+/* Return the slot of the variable name, or -1 if there is no such variable. */
+static
+long
+find_slot (const char * name, unsigned long hash)
+{
+	size_t mask = table_size - 1;
+	size_t i;
+
+	if(table_size == 0)
+		return -1;
+
+	for(i = hash & mask; var_table[i].var != NULL; i = (i + 1) & mask){
+		variable *var = var_table[i].var;
+		if(var != DELETED && var_table[i].hash == hash && strcmp(var -> name, name) == 0)
+			return i;
+	}
+	return -1;
+}
+
+
+/* Put var into the first free slot of its probe sequence. */
+static
+void
+insert_slot (variable * var)
+{
+	size_t mask = table_size - 1;
+	size_t i = var -> hash & mask;
+
+	while(var_table[i].var != NULL && var_table[i].var != DELETED)
+		i = (i + 1) & mask;
+	if(var_table[i].var == NULL)
+		table_used++;
+	var_table[i].hash = var -> hash;
+	var_table[i].var = var;
+}
+
+
+/* Rebuild the table with enough room for one more variable, dropping deleted slots. */
+static
+void
+grow_table (void)
+{
+	size_t new_size = VAR_TABLE_MIN;
+	while(new_size * 3 < (var_count + 1) * 4 * 2)
+		new_size *= 2;
+
+	free(var_table);
+	var_table = emalloc(sizeof(var_slot) * new_size);
+	memset(var_table, 0, sizeof(var_slot) * new_size);
+	table_size = new_size;
+	table_used = 0;
+
+	variable *var;
+	for(var = first_variable; var != NULL; var = var -> next)
+		insert_slot(var);
+}
 
 
 char *
 get_value_by_name (char * name)
 {
-	variable *var = first_variable;
-	while(var != NULL){
-		if(strcmp(name, var -> name) == 0)
-			return var -> value;	/* if success */
-		var = var -> next;
-	}
+	long i = find_slot(name, hash_bytes(name, strlen(name)));
 
-	return NULL;	/* if failed */
+	if(i == -1)
+		return NULL;	/* if failed */
+	return var_table[i].var -> value;	/* if success */
 }
 
 
 void
 delete_variable (char * name)
 {
-	variable *curr_var = first_variable;
-	variable *prev_var = NULL;
-
-	while(curr_var != NULL){
-		if(strcmp(curr_var -> name, name) == 0){
-			if(prev_var == NULL)
-				first_variable = curr_var -> next;
-			else
-				prev_var -> next = curr_var -> next;
-			free(curr_var -> name);
-			free(curr_var -> value);
-			free(curr_var);
-			return;
-		}else{
-			prev_var = curr_var;
-			curr_var = curr_var -> next;
-		}
-	}
+	long i = find_slot(name, hash_bytes(name, strlen(name)));
+	if(i == -1)
+		return;
+
+	variable *var = var_table[i].var;
+	var_table[i].var = DELETED;
+	var_count--;
 
-	return;
+	if(var -> prev == NULL)
+		first_variable = var -> next;
+	else
+		var -> prev -> next = var -> next;
+	if(var -> next == NULL)
+		last_variable = var -> prev;
+	else
+		var -> next -> prev = var -> prev;
+
+	remove_env_entry(var);
+	notify_watches(var -> name, NULL);
+	free(var -> name);
+	free(var -> value);
+	free(var);
 }
 
 
@@ -70,35 +242,181 @@ print_variable_list (void)
 variable *
 get_variable (char * name)
 {
-	variable *var = first_variable;
-
-	while(var != NULL){
-		if(strcmp(var -> name, name) == 0)
-			break;
-		var = var -> next;
-	}
+	long i = find_slot(name, hash_bytes(name, strlen(name)));
 
-	return var;
+	if(i == -1)
+		return NULL;
+	return var_table[i].var;
 }
 
 
+/* Add the variable name with the value value. Both strings must be allocated 
+ * by emalloc() and are owned by the variable list afterwards. If the variable 
+ * already exists, its value is replaced.
+ */
 void
 add_variable (char * name, char * value)
 {
+	unsigned long hash = hash_bytes(name, strlen(name));
+	long i = find_slot(name, hash);
+
+	if(i != -1){
+		variable *var = var_table[i].var;
+		free(var -> value);
+		var -> value = value;
+		var -> value_size = strlen(value) + 1;
+		if(var -> env_index != -1)
+			update_env_entry(var);
+		notify_watches(var -> name, var -> value);
+		free(name);
+		return;
+	}
+
 	variable *new_var = emalloc(sizeof(variable));
 	new_var -> next = NULL;
+	new_var -> prev = last_variable;
 	new_var -> name = name;
 	new_var -> value = value;
+	new_var -> value_size = strlen(value) + 1;
+	new_var -> hash = hash;
+	new_var -> env_index = -1;
+	new_var -> env_entry = NULL;
+	new_var -> env_size = 0;
 
-	if(first_variable == NULL){
+	if(last_variable == NULL)
 		first_variable = new_var;
-	}else{
-		variable *var = first_variable;
-		while(var -> next != NULL)
-			var = var -> next;
-		var -> next = new_var;
+	else
+		last_variable -> next = new_var;
+	last_variable = new_var;
+	var_count++;
+
+	if((table_used + 1) * 4 > table_size * 3)
+		grow_table();	/* also inserts new_var */
+	else
+		insert_slot(new_var);
+	notify_watches(name, value);
+}
+
+
+/* Create the variable name or update its value. The value is copied in place 
+ * when it fits into the memory of the old value.
+ */
+void
+set_variable (char * name, char * value)
+{
+	variable *var;
+	size_t len = strlen(value);
+
+	if((var = get_variable(name)) != NULL){	/* update variable */
+		if(len + 1 > var -> value_size){
+			free(var -> value);
+			var -> value = emalloc(len + 1);
+			var -> value_size = len + 1;
+		}
+		memcpy(var -> value, value, len + 1);
+		if(var -> env_index != -1)
+			update_env_entry(var);
+		notify_watches(var -> name, var -> value);
+	}else{	/* create a new variable */
+		size_t name_len = strlen(name);
+		char *new_name = emalloc(name_len + 1);
+		memcpy(new_name, name, name_len + 1);
+
+		char *new_value = emalloc(len + 1);
+		memcpy(new_value, value, len + 1);
+
+		add_variable(new_name, new_value);
+	}
+}
+
+
+/* Put the variable name into the environment. Return -1 if there is no such variable. */
+int
+export_variable (char * name)
+{
+	variable *var;
+
+	if((var = get_variable(name)) == NULL)
+		return -1;
+	add_env_entry(var);
+	return 0;
+}
+
+
+/* Remove the variable name from the environment, keeping it as a shell variable. */
+void
+unexport_variable (char * name)
+{
+	variable *var;
+
+	if((var = get_variable(name)) != NULL)
+		remove_env_entry(var);
+}
+
+
+void
+print_export_list (void)
+{
+	variable *var = first_variable;
+
+	while(var != NULL){
+		if(var -> env_index != -1)
+			printf("export %s\n", var -> env_entry);
+		var = var -> next;
+	}
+}
+
+
+/* Create an exported variable for every "name=value" string of envp. */
+void
+import_environment (char ** envp)
+{
+	char **ep;
+
+	for(ep = envp; *ep != NULL; ep++){
+		char *eq = strchr(*ep, '=');
+		if(eq == NULL || eq == *ep)
+			continue;
+
+		size_t name_len = eq - *ep;
+		char name[name_len + 1];
+		memcpy(name, *ep, name_len);
+		name[name_len] = '\0';
+
+		set_variable(name, eq + 1);
+		export_variable(name);
+	}
+}
+
+
+/* Call fn with the new value whenever the variable name is set or deleted (with NULL). 
+ * name is not copied.
+ */
+void
+watch_variable (const char * name, void (* fn)(const char * value))
+{
+	if(watch_count == MAX_WATCHES){
+		fprintf(stderr, "watch_variable: too many watches\n");
+		return;
+	}
+	watches[watch_count].name = name;
+	watches[watch_count].fn = fn;
+	watch_count++;
+}
+
+
+/* Return the NULL-terminated environment array of the exported variables. */
+char **
+get_environment (void)
+{
+	if(env_list == NULL){
+		env_size = 64;
+		env_list = emalloc(sizeof(char *) * env_size);
+		env_vars = emalloc(sizeof(variable *) * env_size);
+		env_list[0] = NULL;
 	}
+	return env_list;
 }
 
 
-/* $end variablelib.c */
\ No newline at end of file
+/* $end variablelib.c */
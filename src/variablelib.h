@@ -6,11 +6,19 @@
 #define __VARIABLELIB_H__
 
 
+#include <stddef.h>
+
 typedef struct variable
 {
-	struct variable *next;
+	struct variable *next;		/* next variable in insertion order */
+	struct variable *prev;		/* previous variable in insertion order */
 	char *name;
 	char *value;
+	size_t value_size;			/* bytes allocated for value */
+	unsigned long hash;			/* cached hash of name */
+	int env_index;				/* index in the environment if exported, otherwise -1 */
+	char *env_entry;			/* "name=value" if exported */
+	size_t env_size;			/* bytes allocated for env_entry */
 } variable;
 
 
@@ -19,7 +27,14 @@ extern void delete_variable (char * name);
 extern void print_variable_list (void);
 extern variable * get_variable (char * name);
 extern void add_variable (char * name, char * value);
+extern void set_variable (char * name, char * value);
+extern int export_variable (char * name);
+extern void unexport_variable (char * name);
+extern void print_export_list (void);
+extern void import_environment (char ** envp);
+extern char ** get_environment (void);
+extern void watch_variable (const char * name, void (* fn)(const char * value));
 
 
 #endif /* __VARIABLELIB_H__ */
-/* $end variablelib.h */
\ No newline at end of file
+/* $end variablelib.h */
@@ -4,6 +4,9 @@
 /* $begin wrapper.c */
 #include <stdio.h>
 #include <stdlib.h>
+#include <stddef.h>
+#include <string.h>
+#include "wrapper.h"
 
 static
 void
@@ -33,4 +36,167 @@ erealloc (void * p, size_t n)
 	return rv;
 }
 
-/* $end wrapper.c */
\ No newline at end of file
+
+/* Hash the n bytes at p, eight bytes at a time. */
+unsigned long
+hash_bytes (const void * p, size_t n)
+{
+	const unsigned char *s = p;
+	unsigned long long h = n;
+	unsigned long long w;
+
+	while(n >= 8){
+		memcpy(&w, s, 8);
+		h = ((h << 5 | h >> 59) ^ w) * 0x517cc1b727220a95ULL;
+		s += 8;
+		n -= 8;
+	}
+	w = 0;
+	memcpy(&w, s, n);
+	h = ((h << 5 | h >> 59) ^ w) * 0x517cc1b727220a95ULL;
+	return (unsigned long) (h ^ h >> 32);
+}
+
+
+/********
+ * Arena
+ *******/
+/* $begin arena */
+#define ARENA_ALIGN			_Alignof(max_align_t)
+#define ARENA_HEADER		((sizeof(arena_block) + ARENA_ALIGN - 1) & ~(ARENA_ALIGN - 1))
+#define BLOCK_DATA(b)		((char *) (b) + ARENA_HEADER)
+
+static arena_block *free_blocks = NULL;	/* ordinary blocks kept for reuse */
+static int          nfree_blocks = 0;
+static arena_stats  stats;
+
+
+/* Get a block with at least n usable bytes. */
+static
+arena_block *
+get_block (size_t n)
+{
+	arena_block *b;
+
+	if(n <= ARENA_BLOCK - ARENA_HEADER && free_blocks != NULL){
+		b = free_blocks;
+		free_blocks = b -> next;
+		nfree_blocks--;
+		stats.bytes_cached -= ARENA_BLOCK;
+		stats.reuses++;
+	}else{
+		size_t size = ARENA_BLOCK;
+		if(n > ARENA_BLOCK - ARENA_HEADER)	/* a large request gets a block of its own */
+			size = ARENA_HEADER + n;
+		b = emalloc(size);
+		b -> size = size - ARENA_HEADER;
+		stats.mallocs++;
+	}
+	b -> used = 0;
+	stats.bytes_reserved += b -> size + ARENA_HEADER;
+	return b;
+}
+
+
+static
+void *
+arena_get (arena * a, size_t n, size_t align)
+{
+	arena_block *b = a -> head;
+	size_t pad = 0;
+
+	stats.allocs++;
+	if(b != NULL)
+		pad = (align - b -> used % align) % align;
+	if(b == NULL || b -> used + pad + n > b -> size){
+		arena_block *nb = get_block(n);
+		if(b != NULL && nb -> size > ARENA_BLOCK - ARENA_HEADER 
+		   && b -> size - b -> used >= ARENA_BLOCK / 4){
+			/* Keep allocating from the current block if a large request 
+			 * would otherwise waste much of it.
+			 */
+			nb -> next = b -> next;
+			b -> next = nb;
+			nb -> used = n;
+			a -> used += n;
+			stats.bytes_used += n;
+			return BLOCK_DATA(nb);
+		}
+		if(b != NULL){
+			a -> wasted += b -> size - b -> used;
+			stats.bytes_wasted += b -> size - b -> used;
+		}
+		nb -> next = b;
+		a -> head = b = nb;
+		pad = 0;
+	}
+
+	void *rv = BLOCK_DATA(b) + b -> used + pad;
+	b -> used += pad + n;
+	a -> used += pad + n;
+	stats.bytes_used += pad + n;
+	return rv;
+}
+
+
+void
+arena_init (arena * a)
+{
+	a -> head = NULL;
+	a -> used = 0;
+	a -> wasted = 0;
+	stats.arenas++;
+}
+
+
+void *
+arena_alloc (arena * a, size_t n)
+{
+	return arena_get(a, n, ARENA_ALIGN);
+}
+
+
+/* Copy n bytes of s into the arena and terminate them with '\0'. */
+char *
+arena_strdup (arena * a, const char * s, size_t n)
+{
+	char *rv = arena_get(a, n + 1, 1);
+	memcpy(rv, s, n);
+	rv[n] = '\0';
+	return rv;
+}
+
+
+/* Release all memory of the arena. The arena may live in its own memory. */
+void
+arena_free (arena * a)
+{
+	arena_block *b = a -> head;
+
+	stats.arenas--;
+	stats.bytes_used -= a -> used;
+	stats.bytes_wasted -= a -> wasted;
+	while(b != NULL){
+		arena_block *bnext = b -> next;
+		stats.bytes_reserved -= b -> size + ARENA_HEADER;
+		if(b -> size == ARENA_BLOCK - ARENA_HEADER && nfree_blocks < ARENA_CACHE){
+			b -> next = free_blocks;
+			free_blocks = b;
+			nfree_blocks++;
+			stats.bytes_cached += ARENA_BLOCK;
+		}else
+			free(b);
+		b = bnext;
+	}
+}
+
+
+const arena_stats *
+get_arena_stats (void)
+{
+	return &stats;
+}
+
+/* $end arena */
+
+/* $end wrapper.c */
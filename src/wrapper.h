@@ -8,9 +8,47 @@
 
 #include <stddef.h>
 
+#define ARENA_BLOCK	1024	/* size of an ordinary arena block */
+#define ARENA_CACHE	64		/* maximum number of free blocks kept for reuse */
+
+typedef struct arena_block
+{
+	struct arena_block *next;
+	size_t size;				/* usable bytes in the block */
+	size_t used;				/* bytes handed out from the block */
+} arena_block;
+
+/* An arena hands out memory that is released all at once by arena_free(). */
+typedef struct arena
+{
+	arena_block *head;			/* block that is allocated from, followed by full blocks */
+	size_t used;				/* bytes handed out, including alignment padding */
+	size_t wasted;				/* unused tails of the full blocks */
+} arena;
+
+typedef struct arena_stats
+{
+	unsigned long arenas;		/* live arenas */
+	unsigned long allocs;		/* arena_alloc() and arena_strdup() calls */
+	unsigned long mallocs;		/* blocks obtained from malloc() */
+	unsigned long reuses;		/* blocks taken from the free list */
+	size_t bytes_used;			/* bytes handed out by the live arenas */
+	size_t bytes_reserved;		/* bytes of the blocks owned by the live arenas */
+	size_t bytes_wasted;		/* unused tails of full blocks in the live arenas */
+	size_t bytes_cached;		/* bytes of the blocks in the free list */
+} arena_stats;
+
 extern void * emalloc (size_t n);
 extern void * erealloc (void * p, size_t n);
 
+extern unsigned long hash_bytes (const void * p, size_t n);
+
+extern void arena_init (arena * a);
+extern void * arena_alloc (arena * a, size_t n);
+extern char * arena_strdup (arena * a, const char * s, size_t n);
+extern void arena_free (arena * a);
+extern const arena_stats * get_arena_stats (void);
+
 
 #endif /* __WRAPPER_H__ */
-/* $end wrapper.h */
\ No newline at end of file
+/* $end wrapper.h */